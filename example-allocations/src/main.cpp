@@ -0,0 +1,143 @@
+﻿#include "ofMain.h"
+#include "ofxXively.h"
+
+#include <new>
+#include <cstdlib>
+
+/// Counts the heap allocations made on the calling thread by input() and
+/// output(), by replacing the global operator new.
+/// First the steady-state request path up to the network: templates, body,
+/// queuing and, for reads, the shared cache, which should not allocate at
+/// all. The feeds stand in for the server at sendRequest(), so everything
+/// in front of it runs as in production; the output's first read leads and
+/// publishes its snapshot, the measured ones are all cache hits. Then full
+/// non-threaded round trips, which shows what Poco itself still allocates
+/// per request (or per failure, when there is no network).
+/// Exits with 0 when the request path up to the network does not allocate.
+
+#if __cplusplus >= 201103L
+#define OFX_NEW_THROWS
+#define OFX_DELETE_THROWS noexcept
+#else
+#define OFX_NEW_THROWS throw(std::bad_alloc)
+#define OFX_DELETE_THROWS throw()
+#endif
+
+#if defined(_MSC_VER)
+#define OFX_THREAD_LOCAL __declspec(thread)
+#else
+#define OFX_THREAD_LOCAL __thread
+#endif
+
+namespace {
+	OFX_THREAD_LOCAL bool bCounting = false;
+	OFX_THREAD_LOCAL long iAllocations = 0;
+
+	void* countedAlloc(std::size_t _iSize) {
+		if (bCounting)
+			iAllocations++;
+		void* p = malloc(_iSize == 0 ? 1 : _iSize);
+		if (p == NULL)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void startCounting() {
+		iAllocations = 0;
+		bCounting = true;
+	}
+
+	long stopCounting() {
+		bCounting = false;
+		return iAllocations;
+	}
+}
+
+void* operator new(std::size_t _iSize) OFX_NEW_THROWS { return countedAlloc(_iSize); }
+void* operator new[](std::size_t _iSize) OFX_NEW_THROWS { return countedAlloc(_iSize); }
+void operator delete(void* _p) OFX_DELETE_THROWS { free(_p); }
+void operator delete[](void* _p) OFX_DELETE_THROWS { free(_p); }
+
+/// feeds that stop right at the network
+class OfflineInput : public ofxXivelyInput {
+public:
+	OfflineInput() : ofxXivelyInput(false) {}
+protected:
+	void sendRequest(const ofxXivelyRequest& _request, const string& _sBody) {}
+};
+
+class OfflineOutput : public ofxXivelyOutput {
+public:
+	OfflineOutput() : ofxXivelyOutput(false) {}
+protected:
+	void sendRequest(const ofxXivelyRequest& _request, const string& _sBody) {
+		/// what the server would answer to a csv read of 16 datastreams
+		ofxXivelyResponse response(200, "1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16", _request.url, _request.format);
+		ofNotifyEvent(responseEvent, response, this);
+	}
+};
+
+//--------------------------------------------------------------
+int main(){
+	const int iWarmup = 10;
+	const int iCalls = 1000;
+
+	OfflineInput in;
+	in.setVerbose(false);
+	in.setApiKey("test-key");
+	in.setFeedId(143);
+	in.setDatastreamCount(16);
+
+	OfflineOutput out;
+	out.setVerbose(false);
+	out.setSnapshotDir("");
+	out.setApiKey("test-key");
+	out.setFeedId(1543);
+	out.setCacheTtl(3600.f);
+
+	/// let every buffer grow to its steady-state size first
+	for (int i = 0; i < iWarmup; ++i)
+	{
+		for (int j = 0; j < 16; ++j)
+			in.setValue(j, 1000.f * j + i);
+		in.input(OFX_XIVELY_CSV, true);
+		out.output(OFX_XIVELY_CSV, true);
+	}
+
+	startCounting();
+	for (int i = 0; i < iCalls; ++i)
+	{
+		for (int j = 0; j < 16; ++j)
+			in.setValue(j, 1000.f * j + i);
+		in.input(OFX_XIVELY_CSV, true);
+	}
+	long iInput = stopCounting();
+
+	startCounting();
+	for (int i = 0; i < iCalls; ++i)
+		out.output(OFX_XIVELY_CSV, true);
+	long iOutput = stopCounting();
+
+	printf("input() up to the network:    %.2f allocations per call\n", (double) iInput / iCalls);
+	printf("output() served by the cache: %.2f allocations per call\n", (double) iOutput / iCalls);
+
+	/// the whole way, Poco included
+	const int iRoundTrips = 5;
+	ofxXivelyInput online(false);
+	online.setVerbose(false);
+	online.setApiKey("test-key");
+	online.setFeedId(143);
+	online.setDatastreamCount(16);
+	online.setTimeouts(1.f, 1.f, 2.f);
+	online.input(OFX_XIVELY_CSV, true);
+
+	startCounting();
+	for (int i = 0; i < iRoundTrips; ++i)
+		online.input(OFX_XIVELY_CSV, true);
+	long iOnline = stopCounting();
+
+	printf("input() round trip:           %.2f allocations per call (%s)\n", (double) iOnline / iRoundTrips,
+		online.getLastRequestOk() ? "request went through" : "request failed, counts the error path");
+
+	return iInput == 0 && iOutput == 0 ? 0 : 1;
+}
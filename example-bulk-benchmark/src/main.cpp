@@ -0,0 +1,116 @@
+﻿#include "ofMain.h"
+#include "ofxXively.h"
+
+/// Times the bulk value calls of an input against a loop of per-index
+/// calls, on a feed with many datastreams. Nothing is uploaded until the
+/// end, so getValue() and getValues() return what the feed was created
+/// with while getPendingValue() and getPendingValues() return what was
+/// just set. setValueRanges() is timed against feeding the same minima and
+/// maxima one sample at a time, then a single upload that never leaves the
+/// process checks the ranges getValueRanges() reports.
+/// Exits with 0 when both ways give the same values.
+
+namespace {
+	const int iDatastreams = 4096;
+	const int iRounds = 200;
+
+	class OfflineInput : public ofxXivelyInput {
+	public:
+		OfflineInput() : ofxXivelyInput(false) {}
+	protected:
+		void sendRequest(const ofxXivelyRequest& _request, const string& _sBody) {}
+	};
+
+	double nsPerValue(const Timestamp& _start) {
+		return _start.elapsed() * 1000.0 / ((double) iDatastreams * iRounds);
+	}
+}
+
+//--------------------------------------------------------------
+int main(){
+	OfflineInput in;
+	in.setVerbose(false);
+	in.setApiKey("offline");
+	in.setFeedId(1);
+	in.setDatastreamCount(iDatastreams);
+
+	vector<float> pSet(iDatastreams);
+	vector<float> pGot(iDatastreams);
+	vector<float> pGotBulk(iDatastreams);
+	for (int i = 0; i < iDatastreams; ++i)
+		pSet[i] = i * 0.5f;
+
+	Timestamp start;
+	for (int r = 0; r < iRounds; ++r)
+		for (int i = 0; i < iDatastreams; ++i)
+			in.setValue(i, pSet[i]);
+	double fSetValue = nsPerValue(start);
+
+	start.update();
+	for (int r = 0; r < iRounds; ++r)
+		in.setValues(&pSet[0], iDatastreams);
+	double fSetValues = nsPerValue(start);
+
+	start.update();
+	for (int r = 0; r < iRounds; ++r)
+		for (int i = 0; i < iDatastreams; ++i)
+			pGot[i] = in.getValue(i);
+	double fGetValue = nsPerValue(start);
+
+	start.update();
+	for (int r = 0; r < iRounds; ++r)
+		in.getValues(&pGotBulk[0], iDatastreams);
+	double fGetValues = nsPerValue(start);
+	bool bSameUploaded = pGot == pGotBulk;
+
+	start.update();
+	for (int r = 0; r < iRounds; ++r)
+		for (int i = 0; i < iDatastreams; ++i)
+			pGot[i] = in.getPendingValue(i);
+	double fGetPendingValue = nsPerValue(start);
+
+	start.update();
+	for (int r = 0; r < iRounds; ++r)
+		in.getPendingValues(&pGotBulk[0], iDatastreams);
+	double fGetPendingValues = nsPerValue(start);
+	bool bSamePending = pGot == pGotBulk && pGot == pSet;
+
+	vector<float> pMins(iDatastreams);
+	vector<float> pMaxs(iDatastreams);
+	for (int i = 0; i < iDatastreams; ++i)
+	{
+		pMins[i] = -i * 1.f;
+		pMaxs[i] = i * 2.f;
+	}
+
+	start.update();
+	for (int r = 0; r < iRounds; ++r)
+		for (int i = 0; i < iDatastreams; ++i)
+		{
+			in.setValue(i, pMins[i]);
+			in.setValue(i, pMaxs[i]);
+		}
+	double fSetRange = nsPerValue(start);
+
+	start.update();
+	for (int r = 0; r < iRounds; ++r)
+		in.setValueRanges(&pMins[0], &pMaxs[0], iDatastreams);
+	double fSetRanges = nsPerValue(start);
+
+	/// every sample above fell inside these ranges
+	in.input(OFX_XIVELY_CSV, true);
+	vector<float> pGotMins(iDatastreams);
+	vector<float> pGotMaxs(iDatastreams);
+	in.getValueRanges(&pGotMins[0], &pGotMaxs[0], iDatastreams);
+	bool bSameRanges = pGotMins == pMins && pGotMaxs == pMaxs;
+
+	printf("%d datastreams, ns per value     per-index   bulk\n", iDatastreams);
+	printf("setValue / setValues               %7.1f %7.1f\n", fSetValue, fSetValues);
+	printf("getValue / getValues               %7.1f %7.1f\n", fGetValue, fGetValues);
+	printf("getPendingValue / getPendingValues %7.1f %7.1f\n", fGetPendingValue, fGetPendingValues);
+	printf("setValue x2 / setValueRanges       %7.1f %7.1f\n", fSetRange, fSetRanges);
+	printf("uploaded values %s, pending values %s, ranges %s\n", bSameUploaded ? "match" : "DIFFER",
+		bSamePending ? "match" : "DIFFER", bSameRanges ? "match" : "DIFFER");
+
+	return bSameUploaded && bSamePending && bSameRanges ? 0 : 1;
+}
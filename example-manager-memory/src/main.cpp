@@ -0,0 +1,110 @@
+﻿#include "ofMain.h"
+#include "ofxXively.h"
+
+#include <new>
+#include <cstdlib>
+
+/// Measures what a managed feed costs in memory, by replacing the global
+/// operator new with one that keeps track of the bytes currently allocated.
+/// Adds 10000 feeds to a manager that is never started, half of them inputs
+/// with 4 datastreams and half outputs, and prints the heap and object size
+/// per feed. Removes them all again afterwards to check they give it back.
+/// Not counted: the latency samples every feed keeps once it has sent
+/// requests, up to OFX_XIVELY_LATENCY_SAMPLES floats, and the response data.
+/// Exits with 0 when removing the feeds gives their memory back, apart from
+/// what the manager's containers keep as spare capacity.
+
+#if __cplusplus >= 201103L
+#define OFX_NEW_THROWS
+#define OFX_DELETE_THROWS noexcept
+#else
+#define OFX_NEW_THROWS throw(std::bad_alloc)
+#define OFX_DELETE_THROWS throw()
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+	/// room for the size in front of every block, keeps the alignment of malloc
+	const std::size_t iHeader = 16;
+	volatile long iLiveBytes = 0;
+
+	void countBytes(long _iBytes) {
+#if defined(_MSC_VER)
+		_InterlockedExchangeAdd(&iLiveBytes, _iBytes);
+#else
+		__sync_add_and_fetch(&iLiveBytes, _iBytes);
+#endif
+	}
+
+	long liveBytes() {
+#if defined(_MSC_VER)
+		return _InterlockedExchangeAdd(&iLiveBytes, 0);
+#else
+		return __sync_add_and_fetch(&iLiveBytes, 0);
+#endif
+	}
+
+	void* countedAlloc(std::size_t _iSize) {
+		char* p = (char*) malloc(_iSize + iHeader);
+		if (p == NULL)
+			throw std::bad_alloc();
+		*(std::size_t*) p = _iSize;
+		countBytes((long) _iSize);
+		return p + iHeader;
+	}
+
+	void countedFree(void* _p) {
+		if (_p == NULL)
+			return;
+		char* p = (char*) _p - iHeader;
+		countBytes(-(long) *(std::size_t*) p);
+		free(p);
+	}
+}
+
+void* operator new(std::size_t _iSize) OFX_NEW_THROWS { return countedAlloc(_iSize); }
+void* operator new[](std::size_t _iSize) OFX_NEW_THROWS { return countedAlloc(_iSize); }
+void operator delete(void* _p) OFX_DELETE_THROWS { countedFree(_p); }
+void operator delete[](void* _p) OFX_DELETE_THROWS { countedFree(_p); }
+
+//--------------------------------------------------------------
+int main(){
+	const int iFeeds = 10000;
+	const int iDatastreams = 4;
+
+	ofxXivelyManager manager;
+	manager.setApiKey("test-key");
+
+	/// the first feed also sets up ssl, the resolver and the pools, which every feed shares
+	manager.addOutput(iFeeds * 2);
+	manager.removeFeed(iFeeds * 2);
+
+	long iBefore = liveBytes();
+	for (int i = 0; i < iFeeds / 2; ++i)
+		manager.addInput(i + 1, iDatastreams);
+	long iInputs = liveBytes() - iBefore;
+
+	iBefore = liveBytes();
+	for (int i = iFeeds / 2; i < iFeeds; ++i)
+		manager.addOutput(i + 1);
+	long iOutputs = liveBytes() - iBefore;
+
+	printf("%d feeds managed\n", manager.getFeedCount());
+	printf("input:  %6.0f bytes on the heap per feed, object %d bytes (aggregator %d)\n",
+		(double) iInputs / (iFeeds / 2), (int) sizeof(ofxXivelyInput), (int) sizeof(ofxXivelyAggregator));
+	printf("output: %6.0f bytes on the heap per feed, object %d bytes\n",
+		(double) iOutputs / (iFeeds / 2), (int) sizeof(ofxXivelyOutput));
+	printf("total:  %.1f MB for %d feeds\n", (iInputs + iOutputs) / (1024. * 1024.), iFeeds);
+
+	iBefore = liveBytes() - iInputs - iOutputs;
+	for (int i = 0; i < iFeeds; ++i)
+		manager.removeFeed(i + 1);
+	long iLeft = liveBytes() - iBefore;
+
+	/// the schedule drops removed feeds lazily and the hash map keeps its buckets
+	printf("after removing them: %.0f bytes left per feed\n", (double) iLeft / iFeeds);
+	return iLeft / iFeeds < 64 ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+﻿#include "ofMain.h"
+#include "ofxXively.h"
+
+#include "Poco/Net/ServerSocket.h"
+
+/// Console check of the push subscription against a local plain tcp
+/// stand-in for the Xively socket server: pushed updates are applied,
+/// updates older than the last one seen are dropped, and the subscription
+/// reconnects and catches up after the server drops it.
+/// Exits with 0 when every check passed.
+
+namespace {
+	int iFailures = 0;
+
+	void check(bool _bOk, const string& _sWhat) {
+		printf("[%s] %s\n", _bOk ? " OK " : "FAIL", _sWhat.c_str());
+		if (!_bOk)
+			iFailures++;
+	}
+
+	/// the subscription thread writes the feed, read it under the feed's lock
+	string updated(ofxXivelyOutput& _out) {
+		_out.lock();
+		string sUpdated = _out.getUpdated();
+		_out.unlock();
+		return sUpdated;
+	}
+
+	float value(ofxXivelyOutput& _out) {
+		_out.lock();
+		float fValue = _out.getValue(0);
+		_out.unlock();
+		return fValue;
+	}
+
+	/// polls until the output shows the expected update or the time is up
+	bool waitForUpdate(ofxXivelyOutput& _out, const string& _sUpdated, float _fSeconds) {
+		float fEnd = ofGetElapsedTimef() + _fSeconds;
+		while (ofGetElapsedTimef() < fEnd)
+		{
+			if (updated(_out) == _sUpdated)
+				return true;
+			ofSleepMillis(10);
+		}
+		return updated(_out) == _sUpdated;
+	}
+
+	/// accepts the subscription and reads its subscribe and get messages
+	bool acceptSubscription(ServerSocket& _server, StreamSocket& _client, string& _sReceived) {
+		if (!_server.poll(Timespan(10, 0), Socket::SELECT_READ))
+			return false;
+
+		_client = _server.acceptConnection();
+		_client.setReceiveTimeout(Timespan(5, 0));
+
+		_sReceived = "";
+		char pcBuffer[1024];
+		while (count(_sReceived.begin(), _sReceived.end(), '\n') < 2)
+		{
+			int iReceived = _client.receiveBytes(pcBuffer, sizeof(pcBuffer));
+			if (iReceived <= 0)
+				return false;
+			_sReceived.append(pcBuffer, iReceived);
+		}
+		return true;
+	}
+
+	void push(StreamSocket& _client, const string& _sToken, const string& _sUpdated, const string& _sValue) {
+		string sMessage = "{\"status\":200,\"resource\":\"/feeds/42\",\"token\":\"" + _sToken + "\",\"body\":"
+			"{\"id\":42,\"status\":\"live\",\"updated\":\"" + _sUpdated + "\","
+			"\"datastreams\":[{\"id\":\"0\",\"current_value\":\"" + _sValue + "\"}]}}\n";
+		_client.sendBytes(sMessage.c_str(), sMessage.length());
+	}
+}
+
+//--------------------------------------------------------------
+int main(){
+	ServerSocket server(SocketAddress("127.0.0.1", 0));
+	int iPort = server.address().port();
+
+	ofxXivelyOutput out(false);
+	out.setVerbose(false);
+	out.setSnapshotDir("");
+	out.setApiKey("test-key");
+	out.setFeedId(42);
+	out.subscribe("127.0.0.1", iPort, false);
+
+	/// first connection: subscribe, then catch up with a get
+	StreamSocket client;
+	string sReceived;
+	check(acceptSubscription(server, client, sReceived), "subscription connects");
+	check(sReceived.find("\"method\":\"subscribe\"") != string::npos, "sends subscribe");
+	check(sReceived.find("\"method\":\"get\"") != string::npos, "sends get");
+	check(sReceived.find("\"resource\":\"/feeds/42\"") != string::npos, "asks for the feed");
+	check(sReceived.find("\"X-ApiKey\":\"test-key\"") != string::npos, "passes the api key");
+
+	push(client, "get", "2013-05-01T10:00:00.000000Z", "1.5");
+	check(waitForUpdate(out, "2013-05-01T10:00:00.000000Z", 2.f) && value(out) == 1.5f, "applies the get reply");
+
+	push(client, "sub", "2013-05-01T09:00:00.000000Z", "9");
+	ofSleepMillis(300);
+	check(updated(out) == "2013-05-01T10:00:00.000000Z" && value(out) == 1.5f, "drops an older update");
+
+	push(client, "sub", "2013-05-01T11:00:00.000000Z", "2.5");
+	check(waitForUpdate(out, "2013-05-01T11:00:00.000000Z", 2.f) && value(out) == 2.5f, "applies a pushed update");
+
+	/// drop the connection, the subscription has to come back on its own
+	client.close();
+	check(acceptSubscription(server, client, sReceived), "reconnects after the server closed");
+	check(sReceived.find("\"method\":\"subscribe\"") != string::npos, "subscribes again");
+
+	push(client, "get", "2013-05-01T10:30:00.000000Z", "7");
+	ofSleepMillis(300);
+	check(value(out) == 2.5f, "drops a catch-up reply older than the last update");
+
+	push(client, "sub", "2013-05-01T12:00:00.000000Z", "3.5");
+	check(waitForUpdate(out, "2013-05-01T12:00:00.000000Z", 2.f) && value(out) == 3.5f, "applies updates after reconnecting");
+	check(out.getSubscription()->isConnected(), "reports connected");
+
+	out.unsubscribe();
+	client.close();
+
+	printf("%s, %d failure(s)\n", iFailures == 0 ? "PASSED" : "FAILED", iFailures);
+	return iFailures == 0 ? 0 : 1;
+}
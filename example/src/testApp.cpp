@@ -36,7 +36,9 @@ void testApp::update(){
 	/// Values are updated from Xively if min interval has passed since last update
 	/// Override this by setting the 'force' argument to true
 	/// Feeds can be read as EEML or CSV
-	out->output(OFX_XIVELY_CSV, false);
+	/// When subscribed, updates are pushed by xively and polling is not needed
+	if (!out->isSubscribed())
+		out->output(OFX_XIVELY_CSV, false);
 
 	/// value is set each 'update' but input to xively is done only after min interval has passed
 	/// You can control this maually by some timing functionality, or adjusting in->setMinInterval()
@@ -99,7 +101,8 @@ void testApp::draw(){
 	ofDrawBitmapString(pcText, 20, 315);
 	for (int i = 0; i < in->getDatastreamCount(); ++i)
 	{
-		sprintf(pcText, "Value %d: %f\n", i, in->getValue(i));
+		/// getValue() would show the value of the last upload
+		sprintf(pcText, "Value %d: %f (uploaded %f)\n", i, in->getPendingValue(i), in->getValue(i));
 		ofDrawBitmapString(pcText, 20, 330 + 15 * i);
 	}
 }
@@ -109,6 +112,15 @@ void testApp::keyPressed(int key){
 	/// Press 'e' to refresh feed info compleately as EEML
 	if (key == 'e')
 		out->output(OFX_XIVELY_EEML, true);
+
+	/// Press 's' to switch between polling and push updates
+	if (key == 's')
+	{
+		if (out->isSubscribed())
+			out->unsubscribe();
+		else
+			out->subscribe();
+	}
 }
 
 //--------------------------------------------------------------
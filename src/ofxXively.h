@@ -3,5 +3,6 @@
 
 #include "ofxXivelyInput.h"
 #include "ofxXivelyOutput.h"
+#include "ofxXivelyManager.h"
 
 #endif
@@ -0,0 +1,248 @@
+﻿#include "ofxXivelyAggregator.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <cfloat>
+
+namespace {
+	/// the same primitives Poco::AtomicCounter builds on
+#if defined(_MSC_VER)
+	inline bool tryLock(volatile Poco::Int32* _p) {
+		return _InterlockedExchange((volatile long*) _p, 1) == 0;
+	}
+	inline void unlock(volatile Poco::Int32* _p) {
+		_InterlockedExchange((volatile long*) _p, 0);
+	}
+	inline bool casPointer(ofxXivelyStripe* volatile* _p, ofxXivelyStripe* _pOld, ofxXivelyStripe* _pNew) {
+		return _InterlockedCompareExchangePointer((void* volatile*) _p, _pNew, _pOld) == _pOld;
+	}
+#else
+	inline bool tryLock(volatile Poco::Int32* _p) {
+		return __sync_lock_test_and_set(_p, 1) == 0;
+	}
+	inline void unlock(volatile Poco::Int32* _p) {
+		__sync_lock_release(_p);
+	}
+	inline bool casPointer(ofxXivelyStripe* volatile* _p, ofxXivelyStripe* _pOld, ofxXivelyStripe* _pNew) {
+		return __sync_bool_compare_and_swap(_p, _pOld, _pNew);
+	}
+#endif
+
+	void lock(volatile Poco::Int32* _p) {
+		while (!tryLock(_p))
+			Poco::Thread::yield();
+	}
+
+	/// thread ids are mostly aligned addresses, mix them before taking the stripe
+	inline int threadStripe() {
+		Poco::UInt64 iTid = (Poco::UInt64) (Poco::UIntPtr) Poco::Thread::currentTid();
+		return (int) ((iTid * 0x9E3779B97F4A7C15ULL) >> 40) % OFX_XIVELY_WRITER_STRIPES;
+	}
+}
+
+void ofxXivelyStripe::resize(int _iSize) {
+	pCounts.resize(_iSize);
+	pLasts.resize(_iSize);
+	pMins.resize(_iSize);
+	pMaxs.resize(_iSize);
+	pSums.resize(_iSize);
+	for (int i = 0; i < _iSize; ++i)
+		reset(i);
+}
+
+void ofxXivelyStripe::reset(int _iDatastream) {
+	pCounts[_iDatastream] = 0;
+	pLasts[_iDatastream] = 0.f;
+	pMins[_iDatastream] = FLT_MAX;
+	pMaxs[_iDatastream] = -FLT_MAX;
+	pSums[_iDatastream] = 0.0;
+}
+
+ofxXivelyAggregator::ofxXivelyAggregator() {
+	iSize = 0;
+	for (int i = 0; i < OFX_XIVELY_WRITER_STRIPES; ++i)
+		pStripes[i] = NULL;
+}
+
+ofxXivelyAggregator::~ofxXivelyAggregator() {
+	for (int i = 0; i < OFX_XIVELY_WRITER_STRIPES; ++i)
+		delete pStripes[i];
+}
+
+void ofxXivelyAggregator::setSize(int _iSize) {
+	for (int i = 0; i < OFX_XIVELY_WRITER_STRIPES; ++i)
+		if (pStripes[i] != NULL)
+			pStripes[i]->resize(_iSize);
+	iSize = _iSize;
+}
+
+ofxXivelyStripe& ofxXivelyAggregator::acquire() {
+	int iStripe = threadStripe();
+	ofxXivelyStripe* pStripe = pStripes[iStripe];
+	if (pStripe == NULL)
+	{
+		/// first sample from this stripe, another thread may be installing it too
+		ofxXivelyStripe* pNew = new ofxXivelyStripe(iSize);
+		if (casPointer(&pStripes[iStripe], NULL, pNew))
+			pStripe = pNew;
+		else
+		{
+			delete pNew;
+			pStripe = pStripes[iStripe];
+		}
+	}
+
+	lock(&pStripe->iLock);
+	return *pStripe;
+}
+
+void ofxXivelyAggregator::release(ofxXivelyStripe& _stripe) {
+	unlock(&_stripe.iLock);
+}
+
+unsigned int ofxXivelyAggregator::lockAll() {
+	unsigned int iLocked = 0;
+	for (int i = 0; i < OFX_XIVELY_WRITER_STRIPES; ++i)
+	{
+		ofxXivelyStripe* pStripe = pStripes[i];
+		if (pStripe == NULL)
+			continue;
+
+		lock(&pStripe->iLock);
+		iLocked |= 1u << i;
+	}
+	return iLocked;
+}
+
+void ofxXivelyAggregator::unlockAll(unsigned int _iLocked) {
+	for (int i = 0; i < OFX_XIVELY_WRITER_STRIPES; ++i)
+		if (_iLocked & (1u << i))
+			unlock(&pStripes[i]->iLock);
+}
+
+void ofxXivelyAggregator::add(int _iDatastream, float _fValue) {
+	ofxXivelyStripe& stripe = acquire();
+	stripe.pLasts[_iDatastream] = _fValue;
+	stripe.pMins[_iDatastream] = _fValue < stripe.pMins[_iDatastream] ? _fValue : stripe.pMins[_iDatastream];
+	stripe.pMaxs[_iDatastream] = _fValue > stripe.pMaxs[_iDatastream] ? _fValue : stripe.pMaxs[_iDatastream];
+	stripe.pSums[_iDatastream] += _fValue;
+	stripe.pCounts[_iDatastream]++;
+	release(stripe);
+}
+
+void ofxXivelyAggregator::add(int _iFirst, const float* _pValues, int _iCount) {
+	ofxXivelyStripe& stripe = acquire();
+
+	/// one pass per field over contiguous arrays, simple enough for the compiler to vectorize
+	float* pLasts = &stripe.pLasts[_iFirst];
+	float* pMins = &stripe.pMins[_iFirst];
+	float* pMaxs = &stripe.pMaxs[_iFirst];
+	double* pSums = &stripe.pSums[_iFirst];
+	Poco::Int32* pCounts = &stripe.pCounts[_iFirst];
+	for (int i = 0; i < _iCount; ++i)
+		pLasts[i] = _pValues[i];
+	for (int i = 0; i < _iCount; ++i)
+		pMins[i] = _pValues[i] < pMins[i] ? _pValues[i] : pMins[i];
+	for (int i = 0; i < _iCount; ++i)
+		pMaxs[i] = _pValues[i] > pMaxs[i] ? _pValues[i] : pMaxs[i];
+	for (int i = 0; i < _iCount; ++i)
+		pSums[i] += _pValues[i];
+	for (int i = 0; i < _iCount; ++i)
+		pCounts[i]++;
+
+	release(stripe);
+}
+
+void ofxXivelyAggregator::addRanges(int _iFirst, const float* _pMins, const float* _pMaxs, int _iCount) {
+	ofxXivelyStripe& stripe = acquire();
+
+	float* pMins = &stripe.pMins[_iFirst];
+	float* pMaxs = &stripe.pMaxs[_iFirst];
+	for (int i = 0; i < _iCount; ++i)
+		pMins[i] = _pMins[i] < pMins[i] ? _pMins[i] : pMins[i];
+	for (int i = 0; i < _iCount; ++i)
+		pMaxs[i] = _pMaxs[i] > pMaxs[i] ? _pMaxs[i] : pMaxs[i];
+
+	release(stripe);
+}
+
+bool ofxXivelyAggregator::peek(int _iDatastream, int _iMode, float& _fValue) {
+	return peek(_iDatastream, 1, _iMode, &_fValue) > 0;
+}
+
+int ofxXivelyAggregator::peek(int _iFirst, int _iCount, int _iMode, float* _pValues) {
+	unsigned int iLocked = lockAll();
+
+	int iSampled = 0;
+	for (int i = _iFirst; i < _iFirst + _iCount; ++i)
+	{
+		Poco::Int32 iCount = 0;
+		double dSum = 0.0;
+		float fLast = 0.f;
+		for (int s = 0; s < OFX_XIVELY_WRITER_STRIPES; ++s)
+		{
+			if (!(iLocked & (1u << s)) || pStripes[s]->pCounts[i] == 0)
+				continue;
+
+			const ofxXivelyStripe& stripe = *pStripes[s];
+			iCount += stripe.pCounts[i];
+			dSum += stripe.pSums[i];
+			fLast = stripe.pLasts[i];
+		}
+
+		if (iCount == 0)
+			continue;
+
+		_pValues[i - _iFirst] = _iMode == OFX_XIVELY_AGGREGATE_MEAN ? (float) (dSum / iCount) : fLast;
+		iSampled++;
+	}
+
+	unlockAll(iLocked);
+	return iSampled;
+}
+
+bool ofxXivelyAggregator::drain(float* _pValues, float* _pMins, float* _pMaxs, int* _pCounts, int _iMode) {
+	/// producers of a stripe wait while it is merged, a stripe created meanwhile
+	/// simply goes into the next upload
+	unsigned int iLocked = lockAll();
+
+	bool bAny = false;
+	for (int i = 0; i < iSize; ++i)
+	{
+		Poco::Int32 iCount = 0;
+		double dSum = 0.0;
+		float fLast = 0.f;
+		float fMin = FLT_MAX;
+		float fMax = -FLT_MAX;
+		for (int s = 0; s < OFX_XIVELY_WRITER_STRIPES; ++s)
+		{
+			/// an untouched window still has its range the wrong way round
+			if (!(iLocked & (1u << s)) || pStripes[s]->pMins[i] > pStripes[s]->pMaxs[i])
+				continue;
+
+			ofxXivelyStripe& stripe = *pStripes[s];
+			iCount += stripe.pCounts[i];
+			dSum += stripe.pSums[i];
+			if (stripe.pCounts[i] > 0)
+				fLast = stripe.pLasts[i];
+			fMin = MIN(fMin, stripe.pMins[i]);
+			fMax = MAX(fMax, stripe.pMaxs[i]);
+			stripe.reset(i);
+		}
+
+		_pCounts[i] = iCount;
+		if (fMin > fMax)
+			continue;
+
+		if (iCount > 0)
+			_pValues[i] = _iMode == OFX_XIVELY_AGGREGATE_MEAN ? (float) (dSum / iCount) : fLast;
+		_pMins[i] = fMin;
+		_pMaxs[i] = fMax;
+		bAny = true;
+	}
+
+	unlockAll(iLocked);
+	return bAny;
+}
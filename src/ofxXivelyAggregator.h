@@ -0,0 +1,78 @@
+﻿#ifndef OFX_XIVELY_AGGREGATOR_H
+#define OFX_XIVELY_AGGREGATOR_H
+
+#include "ofMain.h"
+
+#include "ofxXivelyFeed.h"
+
+#include "Poco/Thread.h"
+
+#define OFX_XIVELY_AGGREGATE_LAST  0
+#define OFX_XIVELY_AGGREGATE_MEAN  1
+#define OFX_XIVELY_WRITER_STRIPES  16      /// producer threads are spread over this many private windows
+
+/// One stripe's running last/mean/min/max/count of every datastream since
+/// the last upload, each field in its own contiguous array. Whoever holds
+/// iLock owns all of it, so samples are folded in with plain stores.
+struct ofxXivelyStripe {
+	ofxXivelyStripe(int _iSize) : iLock(0) { resize(_iSize); }
+
+	void					resize(int _iSize);
+	void					reset(int _iDatastream);
+
+	volatile Poco::Int32	iLock;
+	char					pcPadding[64 - sizeof(Poco::Int32)];
+	/// keeps the lock off the cache line of whatever the allocator put before it
+
+	vector<Poco::Int32>		pCounts;
+	vector<float>			pLasts;
+	vector<float>			pMins;
+	vector<float>			pMaxs;
+	vector<double>			pSums;
+};
+
+/// Multi-producer sample ingestion. Any number of threads may call add()
+/// concurrently, a single consumer calls drain() once per upload.
+/// Each thread folds its samples into the window of its own stripe, picked
+/// from its thread id and taken with a single atomic exchange, so a sample
+/// costs one uncontended lock and a few plain stores. Stripes are only
+/// allocated once a thread writes to them. drain() takes every stripe in
+/// turn and merges them, so a batch ends up whole in exactly one upload.
+/// When several threads write the same datastream, _LAST is the last
+/// sample of one of them; use _MEAN for datastreams fed from many threads.
+class ofxXivelyAggregator {
+public:
+	ofxXivelyAggregator();
+	~ofxXivelyAggregator();
+
+	void					setSize(int _iSize);
+	/// not thread safe, call before producers start or while they are paused
+	int						getSize() { return iSize; }
+
+	void					add(int _iDatastream, float _fValue);
+	/// no bounds check, the caller does it
+	void					add(int _iFirst, const float* _pValues, int _iCount);
+	/// consecutive datastreams from _iFirst, one stripe lock for the whole batch
+	void					addRanges(int _iFirst, const float* _pMins, const float* _pMaxs, int _iCount);
+	/// widens the min/max of the window without adding samples, ie for ranges aggregated elsewhere
+	bool					drain(float* _pValues, float* _pMins, float* _pMaxs, int* _pCounts, int _iMode);
+	/// moves the window into arrays of getSize() floats, values and ranges of datastreams
+	/// nothing came in for are left as they were; returns false when nothing came in at all
+	bool					peek(int _iDatastream, int _iMode, float& _fValue);
+	int						peek(int _iFirst, int _iCount, int _iMode, float* _pValues);
+	/// what the next upload would send for this datastream, false if nothing came in yet;
+	/// the bulk call only writes the datastreams that got samples and returns how many did
+
+private:
+	ofxXivelyStripe&		acquire();
+	void					release(ofxXivelyStripe& _stripe);
+	unsigned int			lockAll();
+	void					unlockAll(unsigned int _iLocked);
+	/// drain() and peek() hold every allocated stripe, taken in index order,
+	/// the mask tells which ones were
+
+	int						iSize;
+	ofxXivelyStripe* volatile pStripes[OFX_XIVELY_WRITER_STRIPES];
+};
+
+#endif
@@ -0,0 +1,69 @@
+﻿#include "ofxXivelyCache.h"
+
+namespace {
+	Poco::SingletonHolder<ofxXivelyCache> cacheHolder;
+}
+
+ofxXivelyCache& ofxXivelyCache::instance() {
+	return *cacheHolder.get();
+}
+
+int ofxXivelyCache::join(const string& _sKey, ofxXivelySnapshotPtr& _pSnapshot, float _fTtl) {
+	ofMutex::ScopedLock lock(mutex);
+	Entry& entry = entries[_sKey];
+
+	while (true)
+	{
+		if (!entry.bInFlight)
+		{
+			if (entry.bValid && ofGetElapsedTimef() - entry.fTime <= _fTtl)
+			{
+				_pSnapshot = entry.pSnapshot;
+				return OFX_XIVELY_CACHE_HIT;
+			}
+
+			entry.bInFlight = true;
+			return OFX_XIVELY_CACHE_LEAD;
+		}
+
+		/// somebody else is fetching this feed, wait for its result
+		int iFlight = entry.iFlight;
+		while (entry.iFlight == iFlight)
+			condition.wait(mutex);
+
+		/// its reader gave up for a newer read, not because the feed failed
+		if (entry.bLastSuperseded)
+			continue;
+
+		if (!entry.bLastOk)
+			return OFX_XIVELY_CACHE_FAILED;
+
+		_pSnapshot = entry.pSnapshot;
+		return OFX_XIVELY_CACHE_HIT;
+	}
+}
+
+void ofxXivelyCache::publish(const string& _sKey, const ofxXivelySnapshotPtr& _pSnapshot) {
+	ofMutex::ScopedLock lock(mutex);
+	Entry& entry = entries[_sKey];
+
+	entry.pSnapshot = _pSnapshot;
+	entry.fTime = ofGetElapsedTimef();
+	entry.bValid = true;
+	entry.bLastOk = true;
+	entry.bLastSuperseded = false;
+	entry.bInFlight = false;
+	entry.iFlight++;
+	condition.broadcast();
+}
+
+void ofxXivelyCache::abandon(const string& _sKey, bool _bSuperseded) {
+	ofMutex::ScopedLock lock(mutex);
+	Entry& entry = entries[_sKey];
+
+	entry.bLastOk = false;
+	entry.bLastSuperseded = _bSuperseded;
+	entry.bInFlight = false;
+	entry.iFlight++;
+	condition.broadcast();
+}
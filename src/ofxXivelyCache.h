@@ -0,0 +1,54 @@
+﻿#ifndef OFX_XIVELY_CACHE_H
+#define OFX_XIVELY_CACHE_H
+
+#include "ofMain.h"
+
+#include "ofxXivelyFeed.h"
+
+#include "Poco/Condition.h"
+#include "Poco/SingletonHolder.h"
+
+#define OFX_XIVELY_CACHE_HIT       0
+#define OFX_XIVELY_CACHE_LEAD      1
+#define OFX_XIVELY_CACHE_FAILED    2
+
+/// snapshots are never changed once published, readers share them
+typedef SharedPtr<const ofxXivelySnapshot> ofxXivelySnapshotPtr;
+
+/// Process wide single-flight cache for feed reads.
+/// The first reader of a key becomes the leader and performs the request,
+/// readers arriving while it is in flight wait for its parsed snapshot,
+/// and readers arriving within the ttl after completion get it straight away.
+class ofxXivelyCache {
+public:
+	ofxXivelyCache() {}
+	~ofxXivelyCache() {}
+
+	static ofxXivelyCache&	instance();
+
+	int						join(const string& _sKey, ofxXivelySnapshotPtr& _pSnapshot, float _fTtl);
+	/// returns one of OFX_XIVELY_CACHE_HIT, _LEAD or _FAILED, a hit only copies the pointer
+	void					publish(const string& _sKey, const ofxXivelySnapshotPtr& _pSnapshot);
+	void					abandon(const string& _sKey, bool _bSuperseded = false);
+	/// the leader must call one of these two once its request is done,
+	/// waiters on a superseded request don't fail but take over the read
+
+private:
+	struct Entry {
+		Entry() : bInFlight(false), bValid(false), bLastOk(false), bLastSuperseded(false), iFlight(0), fTime(-1.f) {}
+
+		bool				bInFlight;
+		bool				bValid;
+		bool				bLastOk;
+		bool				bLastSuperseded;
+		int					iFlight;            /// counts finished requests, tells waiters theirs is over
+		float				fTime;              /// completion time of the cached snapshot
+		ofxXivelySnapshotPtr pSnapshot;
+	};
+
+	map<string, Entry>		entries;
+	ofMutex					mutex;
+	Poco::Condition			condition;
+};
+
+#endif
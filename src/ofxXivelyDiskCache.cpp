@@ -0,0 +1,176 @@
+﻿#include "ofxXivelyDiskCache.h"
+
+namespace {
+	const unsigned int iMetaStrings = 11;
+}
+
+bool ofxXivelyDiskCache::save(const string& _sPath, int _iFeedId, const ofxXivelySnapshot& _snapshot) {
+	/// string table first, records need to know where their tags are
+	string sStrings;
+	Poco::UInt32 iStrings = iMetaStrings;
+	writeString(sStrings, _snapshot.sTitle);
+	writeString(sStrings, _snapshot.sStatus);
+	writeString(sStrings, _snapshot.sDescription);
+	writeString(sStrings, _snapshot.sWebsite);
+	writeString(sStrings, _snapshot.sUpdated);
+	writeString(sStrings, _snapshot.location.sDomain);
+	writeString(sStrings, _snapshot.location.sExposure);
+	writeString(sStrings, _snapshot.location.sDisposition);
+	writeString(sStrings, _snapshot.location.sName);
+	writeString(sStrings, _snapshot.location.sLat);
+	writeString(sStrings, _snapshot.location.sLon);
+
+	vector<ofxXivelyDiskRecord> records(_snapshot.pData.size());
+	for (unsigned int i = 0; i < records.size(); ++i)
+	{
+		const ofxXivelyData& data = _snapshot.pData[i];
+		ofxXivelyDiskRecord& record = records[i];
+		record.iId = data.iId;
+		record.fValue = data.fValue;
+		record.fValueMin = data.fValueMin;
+		record.fValueMax = data.fValueMax;
+		record.iTagsFirst = iStrings;
+		record.iTagsCount = data.pTags.size();
+
+		for (unsigned int j = 0; j < data.pTags.size(); ++j)
+			writeString(sStrings, data.pTags[j]);
+		iStrings += data.pTags.size();
+	}
+
+	ofxXivelyDiskHeader header;
+	memcpy(header.pcMagic, OFX_XIVELY_DISK_MAGIC, 4);
+	header.iVersion = OFX_XIVELY_DISK_VERSION;
+	header.iFeedId = _iFeedId;
+	header.iCount = records.size();
+	header.iStringsOffset = sizeof(ofxXivelyDiskHeader) + records.size() * sizeof(ofxXivelyDiskRecord);
+	header.iStringsCount = iStrings;
+	header.iSize = header.iStringsOffset + sStrings.size();
+	header.iReserved = 0;
+
+	string sBuffer;
+	sBuffer.reserve(header.iSize);
+	sBuffer.append((const char*) &header, sizeof(header));
+	if (!records.empty())
+		sBuffer.append((const char*) &records[0], records.size() * sizeof(ofxXivelyDiskRecord));
+	sBuffer.append(sStrings);
+
+	/// write next to the target and rename over it
+	string sDir = Poco::Path(_sPath).parent().toString();
+	string sTemp = Poco::TemporaryFile::tempName(sDir);
+	try
+	{
+		Poco::File(sDir).createDirectories();
+
+		ofstream out(sTemp.c_str(), ios::out | ios::binary | ios::trunc);
+		out.write(sBuffer.data(), sBuffer.size());
+		out.close();
+		if (out.fail())
+		{
+			ofLogError("ofxXively") << "couldn't write snapshot " << sTemp;
+			Poco::File(sTemp).remove();
+			return false;
+		}
+
+		Poco::File(sTemp).renameTo(_sPath);
+	}
+	catch (Exception& exc)
+	{
+		ofLogError("ofxXively") << "couldn't save snapshot: " << exc.displayText();
+		return false;
+	}
+
+	return true;
+}
+
+bool ofxXivelyDiskCache::load(const string& _sPath, int _iFeedId, ofxXivelySnapshot& _snapshot) {
+	try
+	{
+		Poco::File file(_sPath);
+		if (!file.exists() || file.getSize() < sizeof(ofxXivelyDiskHeader))
+			return false;
+
+		Poco::SharedMemory memory(file, Poco::SharedMemory::AM_READ);
+		const char* pcBegin = memory.begin();
+		size_t iSize = memory.end() - memory.begin();
+
+		const ofxXivelyDiskHeader* pHeader = (const ofxXivelyDiskHeader*) pcBegin;
+		if (memcmp(pHeader->pcMagic, OFX_XIVELY_DISK_MAGIC, 4) != 0
+			|| pHeader->iVersion != OFX_XIVELY_DISK_VERSION
+			|| pHeader->iFeedId != _iFeedId
+			|| pHeader->iSize != iSize
+			|| pHeader->iCount > iSize / sizeof(ofxXivelyDiskRecord)
+			|| pHeader->iStringsOffset != sizeof(ofxXivelyDiskHeader) + pHeader->iCount * sizeof(ofxXivelyDiskRecord)
+			|| pHeader->iStringsOffset > iSize
+			|| pHeader->iStringsCount < iMetaStrings
+			|| pHeader->iStringsCount > (iSize - pHeader->iStringsOffset) / sizeof(Poco::UInt32))
+		{
+			ofLogWarning("ofxXively") << "ignoring stale or foreign snapshot " << _sPath;
+			return false;
+		}
+
+		/// index the string table, checking every length against the file
+		vector<const char*> pStrings(pHeader->iStringsCount);
+		vector<Poco::UInt32> pLengths(pHeader->iStringsCount);
+		const char* pc = pcBegin + pHeader->iStringsOffset;
+		const char* pcEnd = pcBegin + iSize;
+		for (unsigned int i = 0; i < pHeader->iStringsCount; ++i)
+		{
+			if (pcEnd - pc < (ptrdiff_t) sizeof(Poco::UInt32))
+				return false;
+			memcpy(&pLengths[i], pc, sizeof(Poco::UInt32));
+			pc += sizeof(Poco::UInt32);
+
+			if ((Poco::UInt32) (pcEnd - pc) < pLengths[i])
+				return false;
+			pStrings[i] = pc;
+			pc += pLengths[i];
+		}
+
+		const ofxXivelyDiskRecord* pRecords = (const ofxXivelyDiskRecord*) (pcBegin + sizeof(ofxXivelyDiskHeader));
+		for (unsigned int i = 0; i < pHeader->iCount; ++i)
+			if (pRecords[i].iTagsFirst < iMetaStrings
+				|| pRecords[i].iTagsFirst > pHeader->iStringsCount
+				|| pRecords[i].iTagsCount > pHeader->iStringsCount - pRecords[i].iTagsFirst)
+				return false;
+
+		_snapshot.sTitle.assign(pStrings[0], pLengths[0]);
+		_snapshot.sStatus.assign(pStrings[1], pLengths[1]);
+		_snapshot.sDescription.assign(pStrings[2], pLengths[2]);
+		_snapshot.sWebsite.assign(pStrings[3], pLengths[3]);
+		_snapshot.sUpdated.assign(pStrings[4], pLengths[4]);
+		_snapshot.location.sDomain.assign(pStrings[5], pLengths[5]);
+		_snapshot.location.sExposure.assign(pStrings[6], pLengths[6]);
+		_snapshot.location.sDisposition.assign(pStrings[7], pLengths[7]);
+		_snapshot.location.sName.assign(pStrings[8], pLengths[8]);
+		_snapshot.location.sLat.assign(pStrings[9], pLengths[9]);
+		_snapshot.location.sLon.assign(pStrings[10], pLengths[10]);
+
+		_snapshot.pData.resize(pHeader->iCount);
+		for (unsigned int i = 0; i < pHeader->iCount; ++i)
+		{
+			const ofxXivelyDiskRecord& record = pRecords[i];
+			ofxXivelyData& data = _snapshot.pData[i];
+			data.iId = record.iId;
+			data.fValue = record.fValue;
+			data.fValueMin = record.fValueMin;
+			data.fValueMax = record.fValueMax;
+
+			data.pTags.resize(record.iTagsCount);
+			for (unsigned int j = 0; j < record.iTagsCount; ++j)
+				data.pTags[j].assign(pStrings[record.iTagsFirst + j], pLengths[record.iTagsFirst + j]);
+		}
+	}
+	catch (Exception& exc)
+	{
+		ofLogError("ofxXively") << "couldn't load snapshot: " << exc.displayText();
+		return false;
+	}
+
+	return true;
+}
+
+void ofxXivelyDiskCache::writeString(string& _buffer, const string& _s) {
+	Poco::UInt32 iLength = _s.length();
+	_buffer.append((const char*) &iLength, sizeof(iLength));
+	_buffer.append(_s);
+}
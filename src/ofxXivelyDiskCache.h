@@ -0,0 +1,53 @@
+﻿#ifndef OFX_XIVELY_DISK_CACHE_H
+#define OFX_XIVELY_DISK_CACHE_H
+
+#include "ofMain.h"
+
+#include "ofxXivelyFeed.h"
+
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/TemporaryFile.h"
+#include "Poco/SharedMemory.h"
+
+#define OFX_XIVELY_DISK_MAGIC      "XIVS"
+#define OFX_XIVELY_DISK_VERSION    1
+
+/// On-disk layout, all fields in host byte order:
+///   header | one record per datastream | string table
+/// Header and records have a fixed size so the file can be used straight
+/// from a memory mapping. The string table holds length prefixed strings:
+/// the 11 feed/location strings first, then every datastream's tags in order.
+struct ofxXivelyDiskHeader {
+	char			pcMagic[4];
+	Poco::UInt32	iVersion;
+	Poco::Int32		iFeedId;
+	Poco::UInt32	iCount;             /// datastream records
+	Poco::UInt32	iStringsOffset;
+	Poco::UInt32	iStringsCount;
+	Poco::UInt32	iSize;              /// whole file
+	Poco::UInt32	iReserved;
+};
+
+struct ofxXivelyDiskRecord {
+	Poco::Int32		iId;
+	float			fValue;
+	float			fValueMin;
+	float			fValueMax;
+	Poco::UInt32	iTagsFirst;         /// index into the string table
+	Poco::UInt32	iTagsCount;
+};
+
+/// Versioned binary snapshots of a feed, written atomically through a
+/// temporary file so a reader never sees a half written one.
+class ofxXivelyDiskCache {
+public:
+	static bool		save(const string& _sPath, int _iFeedId, const ofxXivelySnapshot& _snapshot);
+	static bool		load(const string& _sPath, int _iFeedId, ofxXivelySnapshot& _snapshot);
+	/// fails on missing, foreign, truncated or other version files
+
+private:
+	static void		writeString(string& _buffer, const string& _s);
+};
+
+#endif
@@ -1,5 +1,14 @@
 ﻿#include "ofxXivelyFeed.h"
 
+#ifndef TARGET_WIN32
+#include <signal.h>
+#endif
+
+namespace {
+	ofMutex sslMutex;
+	bool bSslReady = false;
+}
+
 ofxXivelyFeed::ofxXivelyFeed(bool _bThreaded) {
 	bThreaded = _bThreaded;
 	bVerbose = true;
@@ -9,28 +18,60 @@ ofxXivelyFeed::ofxXivelyFeed(bool _bThreaded) {
 	iFeedId = -1;
 
 	fMinInterval = OFX_XIVELY_MIN_INTERVAL;
+	fConnectTimeout = 2.f;
+	fReadTimeout = 3.f;
+	fTotalTimeout = 5.f;
+
+	pInFlight = NULL;
+	bInFlightGet = false;
+	bCancelled = false;
+	iLatencyNext = 0;
+	iDeadlineMisses = 0;
+	iCancelled = 0;
 	bRequestQueued = false;
+	iTemplateMethod = OFX_XIVELY_GET;
 	bLastRequestOk = true;
 	fLastResponseTime = -1.f;
 
+	initSsl();
+
+	pQueueCondition = NULL;
+	if (bThreaded)
+	{
+		pQueueCondition = new Poco::Condition();
+		startThread();
+	}
+}
+
+ofxXivelyFeed::~ofxXivelyFeed() {
+	if (bThreaded)
+	{
+		requestMutex.lock();
+		stopThread();
+		pQueueCondition->signal();
+		requestMutex.unlock();
+		waitForThread(false);
+		delete pQueueCondition;
+	}
+}
+
+void ofxXivelyFeed::initSsl() {
+	/// once per process, however many feeds there are
+	ofMutex::ScopedLock lock(sslMutex);
+	if (bSslReady)
+		return;
+
 	try {
 		HTTPSStreamFactory::registerFactory();
 		SharedPtr<PrivateKeyPassphraseHandler> pConsoleHandler = new KeyConsoleHandler(false);
 		SharedPtr<InvalidCertificateHandler> pInvalidCertHandler = new ConsoleCertificateHandler(true);
 		Context::Ptr pContext = new Context(Context::CLIENT_USE, "", Context::VERIFY_NONE);
 		SSLManager::instance().initializeClient(pConsoleHandler, pInvalidCertHandler, pContext);
+		bSslReady = true;
 	}
 	catch (Poco::SystemException & PS) {
 		ofLogError("ofxXively") << "couldn't create factory: " << PS.displayText();
 	}
-
-	if (bThreaded)
-		startThread();
-}
-
-ofxXivelyFeed::~ofxXivelyFeed() {
-	if (bThreaded)
-		stopThread();
 }
 
 void ofxXivelyFeed::setMinInterval(float fSeconds) {
@@ -38,79 +79,290 @@ void ofxXivelyFeed::setMinInterval(float fSeconds) {
 		fMinInterval = fSeconds;
 }
 
+void ofxXivelyFeed::setTimeouts(float _fConnect, float _fRead, float _fTotal) {
+	if (_fConnect > 0.f) fConnectTimeout = _fConnect;
+	if (_fRead > 0.f) fReadTimeout = _fRead;
+	if (_fTotal > 0.f) fTotalTimeout = _fTotal;
+	buildTemplates();
+}
+
 void ofxXivelyFeed::setApiKey(string _sApiKey) {
 	sApiKey = _sApiKey;
+	buildTemplates();
 }
 
 void ofxXivelyFeed::setFeedId(int _iId) {
 	iFeedId = _iId;
+	buildTemplates();
+}
+
+void ofxXivelyFeed::buildTemplates() {
+	const char* pcExtensions[2] = { "csv", "xml" };
+	char pcUrl[256];
+
+	for (int i = 0; i < 2; ++i)
+	{
+		SharedPtr<ofxXivelyRequest> pTemplate = new ofxXivelyRequest();
+		ofxXivelyRequest& tmpl = *pTemplate;
+		tmpl.method = iTemplateMethod;
+		tmpl.format = i;
+		sprintf(pcUrl, "%s%d.%s", sApiUrl.c_str(), iFeedId, pcExtensions[i]);
+		tmpl.setUrl(pcUrl);
+		tmpl.connectTimeout = Timespan((Timespan::TimeDiff) (fConnectTimeout * 1000000));
+		tmpl.readTimeout = Timespan((Timespan::TimeDiff) (fReadTimeout * 1000000));
+		tmpl.totalTimeout = Timespan((Timespan::TimeDiff) (fTotalTimeout * 1000000));
+		tmpl.key = tmpl.url + " " + sApiKey;
+		tmpl.addHeader("X-ApiKey", sApiKey);
+
+		ofxXivelyResolver::instance().prefetch(tmpl.host);
+
+		requestMutex.lock();
+		pTemplates[i] = pTemplate;
+		requestMutex.unlock();
+	}
+}
+
+SharedPtr<ofxXivelyRequest> ofxXivelyFeed::getTemplate(int _iFormat) {
+	ofMutex::ScopedLock lock(requestMutex);
+	return pTemplates[_iFormat];
+}
+
+void ofxXivelyFeed::submitRequest(int _iFormat) {
+	SharedPtr<ofxXivelyRequest> pTemplate = getTemplate(_iFormat);
+
+	if (bThreaded)
+	{
+		ofMutex::ScopedLock lock(requestMutex);
+		queuedRequest = pTemplate;
+		bRequestQueued = true;
+
+		/// a read still in flight would only bring older data. Cancelling it in the
+		/// same lock as the queuing means the worker cannot have picked up this one yet
+		if (pTemplate->method == OFX_XIVELY_GET)
+			cancelInFlight();
+		pQueueCondition->signal();
+	}
+	else
+	{
+		queuedRequest = pTemplate;
+		processRequest(*queuedRequest, sQueuedBody);
+	}
 }
 
 void ofxXivelyFeed::threadedFunction() {
 	ofLogVerbose("Xively") << "Thread started";
 
-	while (true)
+#ifndef TARGET_WIN32
+	/// a cancelled read leaves its socket shut down under the ssl session, and
+	/// deleting that session sends close_notify into it. Sessions are only ever
+	/// cancelled on this thread, keep the resulting SIGPIPE from killing the app
+	sigset_t sigpipe;
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+#endif
+
+	while (isThreadRunning())
 	{
-		// check if new request is available
-		if (bRequestQueued)
-		{
-			ofLogVerbose("Xively") << "New request available";
+		// wait for a new request, waking up now and then to notice stopThread()
+		requestMutex.lock();
+		while (!bRequestQueued && isThreadRunning())
+			pQueueCondition->tryWait(requestMutex, 1000);
 
-			sendRequest(request);
-			bRequestQueued = false;
+		if (!bRequestQueued)
+		{
+			requestMutex.unlock();
+			continue;
 		}
 
-		// sleep
-		ofSleepMillis(1000);
+		ofLogVerbose("Xively") << "New request available";
+		SharedPtr<ofxXivelyRequest> activeRequest = queuedRequest;
+		sActiveBody.swap(sQueuedBody);
+		bRequestQueued = false;
+		requestMutex.unlock();
+
+		processRequest(*activeRequest, sActiveBody);
 	}
 }
 
-void ofxXivelyFeed::sendRequest(ofxXivelyRequest request) {
-	try{
-		URI uri(request.url.c_str());
-		string path(uri.getPathAndQuery());
-		if (path.empty()) path = "/";
+void ofxXivelyFeed::processRequest(const ofxXivelyRequest& _request, const string& _sBody) {
+	sendRequest(_request, _sBody);
+}
 
-		ofPtr<HTTPSession> session;
-		istream * rs;
-		HTTPSClientSession * httpsSession = new HTTPSClientSession(uri.getHost(), uri.getPort());
-		httpsSession->setTimeout(Timespan(request.timeout, 0));
+Timespan ofxXivelyFeed::budget(const Timespan& _phase, const Timespan& _total, const Timestamp& _start) {
+	Timespan remaining = _total - Timespan(_start.elapsed());
+	if (remaining.totalMicroseconds() <= 0)
+		throw TimeoutException("request deadline exceeded");
 
-		HTTPRequest req(HTTPRequest::HTTP_GET, path, HTTPMessage::HTTP_1_1);
-		if (request.method == OFX_XIVELY_PUT)
-			req.setMethod(HTTPRequest::HTTP_PUT);
+	return remaining < _phase ? remaining : _phase;
+}
 
-		/// headers
-		for (unsigned int i = 0; i < request.headerIds.size(); i++){
-			const string name = request.headerIds[i].c_str();
-			const string val = request.headerValues[i].c_str();
-			req.set(name, val);
-		}
+void ofxXivelyFeed::readBody(HTTPSClientSession& _session, istream& _body, string& _sBody,
+							 const Timespan& _phase, const Timespan& _total, const Timestamp& _start) {
+	char pcBuffer[4096];
+	while (true)
+	{
+		_session.socket().setReceiveTimeout(budget(_phase, _total, _start));
+
+		/// peek() waits for one refill of the stream buffer at most
+		if (_body.peek() == EOF)
+			break;
+
+		streamsize iRead = _body.readsome(pcBuffer, sizeof(pcBuffer));
+		_sBody.append(pcBuffer, (size_t) iRead);
+	}
+
+	/// the stream swallows what its buffer threw, the session kept it
+	if (_body.bad())
+	{
+		if (_session.networkException() != NULL)
+			_session.networkException()->rethrow();
+		throw NetException("couldn't read the response body");
+	}
+}
+
+void ofxXivelyFeed::sendRequest(const ofxXivelyRequest& request, const string& _sBody) {
+	HTTPSClientSession * httpsSession = NULL;
+	Timestamp start;
+
+	requestMutex.lock();
+	bCancelled = false;
+	requestMutex.unlock();
+
+	/// a second attempt only when a pooled session turns out to be closed
+	for (int iAttempt = 0; iAttempt < 2; ++iAttempt)
+	{
+		bool bReused = false;
+		bool bResponseStarted = false;
+		try{
+			istream * rs;
+			httpsSession = ofxXivelySessionPool::instance().acquire(request.host, request.port, budget(request.connectTimeout, request.totalTimeout, start), bReused, iAttempt > 0);
+			/// only used if a pooled session has to reconnect
+			httpsSession->setTimeout(budget(request.connectTimeout, request.totalTimeout, start));
+
+			requestMutex.lock();
+			pInFlight = httpsSession;
+			bInFlightGet = request.method == OFX_XIVELY_GET;
+			requestMutex.unlock();
+
+			HTTPRequest req(request.method == OFX_XIVELY_PUT ? HTTPRequest::HTTP_PUT : HTTPRequest::HTTP_GET, request.path, HTTPMessage::HTTP_1_1);
+			req.setKeepAlive(true);
+
+			/// headers
+			for (unsigned int i = 0; i < request.headerIds.size(); i++)
+				req.set(request.headerIds[i], request.headerValues[i]);
+
+			req.setContentLength((int) _sBody.length());
+
+			ofLogVerbose("Xively") << "-----------------------------";
+			ofLogVerbose("Xively") << "write data request";
+			httpsSession->sendRequest(req) << _sBody;
+
+			/// connected by now, a reused session still carries the timeout of its first request
+			httpsSession->socket().setReceiveTimeout(budget(request.readTimeout, request.totalTimeout, start));
+
+			ofLogVerbose("Xively") << "about to receive a response";
+			HTTPResponse res;
+			rs = &httpsSession->receiveResponse(res);
+			bResponseStarted = true;
+			ofLogVerbose("Xively") << "received a session response";
+
+			ofLogVerbose("Xively") << "create new response object";
+			string sResponseBody;
+			readBody(*httpsSession, *rs, sResponseBody, request.readTimeout, request.totalTimeout, start);
+			ofxXivelyResponse response = ofxXivelyResponse(res, sResponseBody, request.path, request.format);
 
-		req.set("Content-Length", ofToString((int) request.data.length()));
+			requestMutex.lock();
+			pInFlight = NULL;
+			bool bReusable = !bCancelled && res.getKeepAlive();
+			requestMutex.unlock();
 
-		ofLogVerbose("Xively") << "-----------------------------";
-		ofLogVerbose("Xively") << "write data request";
-		httpsSession->sendRequest(req) << request.data;
+			/// the body has been read, the connection can serve the next request
+			/// unless it was shut down just too late to abort this one
+			ofxXivelySessionPool::instance().release(httpsSession, request.host, request.port, bReusable);
+			httpsSession = NULL;
 
-		ofLogVerbose("Xively") << "about to receive a response";
-		HTTPResponse res;
-		rs = &httpsSession->receiveResponse(res);
-		session = ofPtr<HTTPSession>(httpsSession);
-		ofLogVerbose("Xively") << "received a session response";
+			float fLatency = start.elapsed() / 1000000.f;
+			recordLatency(fLatency, fLatency > request.totalTimeout.totalMicroseconds() / 1000000.f);
 
-		ofLogVerbose("Xively") << "create new response object";
-		ofxXivelyResponse response = ofxXivelyResponse(res, *rs, path, request.format);
+			ofLogVerbose("Xively") << "broadcast response event";
+			ofNotifyEvent(responseEvent, response, this);
 
-		ofLogVerbose("Xively") << "broadcast response event";
-		ofNotifyEvent(responseEvent, response, this);
+			ofLogVerbose("Xively") << "------------------------------";
+			return;
+		}
+		catch (Exception& exc) {
+			requestMutex.lock();
+			pInFlight = NULL;
+			bool bSuperseded = bCancelled;
+			if (bSuperseded)
+				iCancelled++;
+			requestMutex.unlock();
+
+			/// the server closed the idle connection before we wrote to it, nothing
+			/// of this request reached it, so it is safe to send again
+			if (!bSuperseded && bReused && !bResponseStarted && dynamic_cast<NetException*>(&exc) != NULL)
+			{
+				ofLogVerbose("Xively") << "pooled session was closed, retrying on a new one: " << exc.displayText();
+				ofxXivelySessionPool::instance().release(httpsSession, request.host, request.port, false);
+				httpsSession = NULL;
+				continue;
+			}
 
-		ofLogVerbose("Xively") << "------------------------------";
+			if (bSuperseded)
+				ofLogVerbose("Xively") << "request superseded by a newer one";
+			else
+			{
+				ofLogError("ofxXively") << "Poco exception nr " << exc.code() << ": " << exc.displayText();
+				bLastRequestOk = false;
+				recordLatency(start.elapsed() / 1000000.f, dynamic_cast<TimeoutException*>(&exc) != NULL);
+			}
+			ofxXivelySessionPool::instance().release(httpsSession, request.host, request.port, false);
+			return;
+		}
 	}
-	catch (Exception& exc) {
-		ofLogError("ofxXively") << "Poco exception nr " << exc.code() << ": " << exc.displayText();
-		bLastRequestOk = false;
+}
+
+void ofxXivelyFeed::cancelInFlight() {
+	/// called with requestMutex held
+	if (pInFlight == NULL || !bInFlightGet || bCancelled)
+		return;
+
+	/// shutting the descriptor down wakes the blocked read, the session is then
+	/// deleted on the feed thread and never goes back to the pool
+	bCancelled = true;
+	::shutdown(pInFlight->socket().impl()->sockfd(), 2);
+}
+
+bool ofxXivelyFeed::wasSuperseded() {
+	ofMutex::ScopedLock lock(requestMutex);
+	return bCancelled;
+}
+
+void ofxXivelyFeed::recordLatency(float _fSeconds, bool _bMissed) {
+	ofMutex::ScopedLock lock(requestMutex);
+	if (pLatencies.size() < OFX_XIVELY_LATENCY_SAMPLES)
+		pLatencies.push_back(_fSeconds);
+	else
+		pLatencies[iLatencyNext] = _fSeconds;
+	iLatencyNext = (iLatencyNext + 1) % OFX_XIVELY_LATENCY_SAMPLES;
+
+	if (_bMissed)
+		iDeadlineMisses++;
+}
+
+float ofxXivelyFeed::getLatency(float _fPercentile) {
+	vector<float> pSorted;
+	{
+		ofMutex::ScopedLock lock(requestMutex);
+		pSorted = pLatencies;
 	}
+	if (pSorted.empty())
+		return -1.f;
+
+	unsigned int iIndex = (unsigned int) (ofClamp(_fPercentile, 0.f, 1.f) * (pSorted.size() - 1) + 0.5f);
+	nth_element(pSorted.begin(), pSorted.begin() + iIndex, pSorted.end());
+	return pSorted[iIndex];
 }
 
 float ofxXivelyFeed::getValue(int _datastream) {
@@ -120,6 +372,38 @@ float ofxXivelyFeed::getValue(int _datastream) {
 	return 0.f;
 }
 
+int ofxXivelyFeed::getValues(float* _pValues, int _iCount, int _iFirst) {
+	if (_iFirst < 0 || _iFirst >= (int) pValues.size() || _iCount <= 0)
+		return 0;
+
+	int iCount = MIN(_iCount, (int) pValues.size() - _iFirst);
+	memcpy(_pValues, &pValues[_iFirst], iCount * sizeof(float));
+	return iCount;
+}
+
+int ofxXivelyFeed::getValueRanges(float* _pMin, float* _pMax, int _iCount, int _iFirst) {
+	if (_iFirst < 0 || _iFirst >= (int) pValueMins.size() || _iCount <= 0)
+		return 0;
+
+	int iCount = MIN(_iCount, (int) pValueMins.size() - _iFirst);
+	memcpy(_pMin, &pValueMins[_iFirst], iCount * sizeof(float));
+	memcpy(_pMax, &pValueMaxs[_iFirst], iCount * sizeof(float));
+	return iCount;
+}
+
+void ofxXivelyFeed::syncValues() {
+	int iSize = pData.size();
+	pValues.resize(iSize);
+	pValueMins.resize(iSize);
+	pValueMaxs.resize(iSize);
+	for (int i = 0; i < iSize; ++i)
+	{
+		pValues[i] = pData[i].fValue;
+		pValueMins[i] = pData[i].fValueMin;
+		pValueMaxs[i] = pData[i].fValueMax;
+	}
+}
+
 ofxXivelyData * ofxXivelyFeed::getDataStruct(int _datastream) {
 	if (_datastream >= pData.size())
 		return NULL;
@@ -27,6 +27,8 @@
 #define OFX_XIVELY_PUT             1
 #define OFX_XIVELY_CSV             0
 #define OFX_XIVELY_EEML            1
+#define OFX_XIVELY_JSON            2
+#define OFX_XIVELY_LATENCY_SAMPLES 256     /// requests kept for latency percentiles
 
 #include "Poco/Net/HTTPSession.h"
 #include "Poco/Net/HTTPClientSession.h"
@@ -38,13 +40,18 @@
 #include "Poco/URI.h"
 #include "Poco/Exception.h"
 #include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Condition.h"
 #include "Poco/Net/HTTPSStreamFactory.h"
 #include "Poco/Net/SSLManager.h"
 #include "Poco/Net/KeyConsoleHandler.h"
 #include "Poco/Net/ConsoleCertificateHandler.h"
+#include "Poco/Net/SocketDefs.h"
 
 #include <fstream>
 
+#include "ofxXivelySessionPool.h"
+
 using namespace std;
 using namespace Poco::Net;
 using namespace Poco;
@@ -66,6 +73,16 @@ struct ofxXivelyData {
 	float fValueMax;
 };
 
+struct ofxXivelySnapshot {
+	vector<ofxXivelyData> pData;
+	ofxXivelyLocation     location;
+	string                sTitle;
+	string                sStatus;
+	string                sDescription;
+	string                sWebsite;
+	string                sUpdated;
+};
+
 struct ofxXivelyRequest {
 	ofxXivelyRequest() {}
 	~ofxXivelyRequest() {
@@ -75,13 +92,17 @@ struct ofxXivelyRequest {
 	int            method;             /// GET or PUT
 	int            format;             /// CSV or EEML
 	string         url;
-	int            timeout;            /// connection timeout
+	string         host;               /// url split once when the template is built
+	int            port;
+	string         path;
+	Timespan       connectTimeout;     /// budget for a new connection
+	Timespan       readTimeout;        /// budget for each wait on the server
+	Timespan       totalTimeout;       /// deadline for the whole request
+	string         key;                /// url and api key, reads with the same key are shared
 
 	vector<string> headerIds;          /// http header values/ids
 	vector<string> headerValues;
 
-	string         data;
-
 	// ----------------------------------------------------------------------
 	void addHeader(string id, string value){
 		headerIds.push_back(id);
@@ -92,6 +113,15 @@ struct ofxXivelyRequest {
 		headerIds.clear();
 		headerValues.clear();
 	}
+	// ----------------------------------------------------------------------
+	void setUrl(string _url){
+		url = _url;
+		URI uri(url);
+		host = uri.getHost();
+		port = uri.getPort();
+		path = uri.getPathAndQuery();
+		if (path.empty()) path = "/";
+	}
 };
 
 struct ofxXivelyResponse {
@@ -105,6 +135,23 @@ struct ofxXivelyResponse {
 		url = _url;
 		format = _format;
 	}
+	ofxXivelyResponse(HTTPResponse& pocoResponse, const string& _body, string _url, int _format) {
+		status = pocoResponse.getStatus();
+		timestamp = pocoResponse.getDate();
+		reasonForStatus = pocoResponse.getReasonForStatus(pocoResponse.getStatus());
+		contentType = pocoResponse.getContentType();
+
+		responseBody = _body;
+		url = _url;
+		format = _format;
+	}
+	ofxXivelyResponse(int _status, const string& _body, string _url, int _format) {
+		status = _status;
+		reasonForStatus = HTTPResponse::getReasonForStatus((HTTPResponse::HTTPStatus) _status);
+		responseBody = _body;
+		url = _url;
+		format = _format;
+	}
 	~ofxXivelyResponse() {}
 
 	int             status; 				/// return code for the response ie: 200 = OK
@@ -113,7 +160,7 @@ struct ofxXivelyResponse {
 	string          contentType;			/// the mime type of the response
 	Timestamp timestamp;		        /// time of the response
 	string          url;
-	int             format;                 /// CSV/EEML
+	int             format;                 /// CSV/EEML/JSON
 };
 
 class ofxXivelyFeed : public ofThread {
@@ -123,24 +170,62 @@ public:
 
 	void					setMinInterval(float fSeconds);
 	void					setApiKey(string _sApiKey);
-	void					setFeedId(int _iId);
+	virtual void			setFeedId(int _iId);
 	int						getFeedId() { return iFeedId; }
 	void					setVerbose(bool _bVerbose) { bVerbose = _bVerbose; }
+	void					setTimeouts(float _fConnect, float _fRead, float _fTotal);
+	/// seconds, fractions allowed, defaults 2, 3 and 5
+	static Timespan         budget(const Timespan& _phase, const Timespan& _total, const Timestamp& _start);
+	/// what is left of the total deadline, capped to the budget of the next phase,
+	/// throws a TimeoutException once the deadline has passed
+	static void             readBody(HTTPSClientSession& _session, istream& _body, string& _sBody,
+								const Timespan& _phase, const Timespan& _total, const Timestamp& _start);
+	/// appends the response body a buffer at a time, renewing the receive timeout
+	/// from budget() before each read, so a slow body can't outlast the deadline
 
 	bool                    getLastRequestOk() { return bLastRequestOk; }
 	float                   getLastResponseTime() { return fLastResponseTime; }
+	float                   getLatency(float _fPercentile);
+	/// seconds, over the last requests, ie 0.99 for the tail
+	int                     getDeadlineMisses() { return iDeadlineMisses; }
+	/// requests that timed out or took longer than their total deadline
+	int                     getCancelledCount() { return iCancelled; }
+	/// reads aborted because a newer one superseded them
 
 	int						getDatastreamCount() { return pData.size(); }
 	float					getValue(int _datastream);
+	int						getValues(float* _pValues, int _iCount, int _iFirst = 0);
+	int						getValueRanges(float* _pMin, float* _pMax, int _iCount, int _iFirst = 0);
+	/// copy up to _iCount datastreams from _iFirst, returns how many were copied
 	ofxXivelyData*			getDataStruct(int _datastream);
 
 protected:
+	static void             initSsl();
 	bool                    bThreaded;
 
 	bool                    bRequestQueued;
-	ofxXivelyRequest        request;
+	SharedPtr<ofxXivelyRequest> queuedRequest;
+	string                  sQueuedBody;
+	/// the queued request is its template plus the body of this call
+	string                  sActiveBody;
+	/// the thread swaps the queued body in here, so a newer one can be queued meanwhile
+	SharedPtr<ofxXivelyRequest> pTemplates[2];
+	/// CSV and EEML requests for this feed, never changed once built but replaced
+	/// as a whole when the api key or feed id change, so requests in flight keep theirs
+	int                     iTemplateMethod;
+	void                    buildTemplates();
+	SharedPtr<ofxXivelyRequest> getTemplate(int _iFormat);
+	void                    submitRequest(int _iFormat);
+	/// sends the template of this format with sQueuedBody, or queues it when threaded
 	void                    threadedFunction();
-	void                    sendRequest(ofxXivelyRequest request);
+	virtual void            processRequest(const ofxXivelyRequest& _request, const string& _sBody);
+	/// default just sends, subclasses may serve the request some other way
+	virtual void            sendRequest(const ofxXivelyRequest& _request, const string& _sBody);
+	/// the network round trip, a subclass may stand in for the server
+	void                    cancelInFlight();
+	/// aborts a GET in flight, submitRequest() does it when queuing a newer one
+	bool                    wasSuperseded();
+	/// whether the last sendRequest() was aborted by a newer read
 
 	ofEvent<ofxXivelyResponse> responseEvent;
 	virtual void            onResponse(ofxXivelyResponse& response) = 0;
@@ -159,9 +244,30 @@ protected:
 	vector<string>::iterator itTags;
 	vector<ofxXivelyData>::iterator itData;
 	vector<ofxXivelyData> pData;
+	vector<float>         pValues;
+	vector<float>         pValueMins;
+	vector<float>         pValueMaxs;
+	/// the values of pData once more, one contiguous array per field for the bulk calls
+	void                  syncValues();
+	/// copies pData into the arrays, call after pData changed
 	/// <- FEED DATA
 
 	float					fMinInterval;
+	float					fConnectTimeout;
+	float					fReadTimeout;
+	float					fTotalTimeout;
+
+	ofMutex                 requestMutex;
+	Poco::Condition*        pQueueCondition;
+	/// only threaded feeds wait for requests, a condition costs a heap block per feed
+	HTTPSClientSession*     pInFlight;
+	bool                    bInFlightGet;
+	bool                    bCancelled;
+	vector<float>           pLatencies;
+	int                     iLatencyNext;
+	int                     iDeadlineMisses;
+	int                     iCancelled;
+	void                    recordLatency(float _fSeconds, bool _bMissed);
 
 	bool					bVerbose;
 };
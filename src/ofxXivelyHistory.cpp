@@ -0,0 +1,295 @@
+﻿#include "ofxXivelyHistory.h"
+
+ofxXivelyHistory::ofxXivelyHistory(string _sApiUrl, string _sApiKey, int _iFeedId) {
+	sApiUrl = _sApiUrl;
+	sApiKey = _sApiKey;
+	iFeedId = _iFeedId;
+
+	iWorkers = OFX_XIVELY_HISTORY_WORKERS;
+	iPageSeconds = OFX_XIVELY_HISTORY_PAGE;
+	setTimeouts(2.f, 3.f, 5.f);
+
+	iDatastream = 0;
+	iNextPage = 0;
+	bFailed = false;
+}
+
+ofxXivelyHistory::~ofxXivelyHistory() {}
+
+void ofxXivelyHistory::setWorkers(int _iWorkers) {
+	if (_iWorkers > 0)
+		iWorkers = _iWorkers;
+}
+
+void ofxXivelyHistory::setPageSeconds(int _iSeconds) {
+	if (_iSeconds > 0 && _iSeconds <= OFX_XIVELY_HISTORY_PAGE)
+		iPageSeconds = _iSeconds;
+}
+
+void ofxXivelyHistory::setTimeouts(float _fConnect, float _fRead, float _fTotal) {
+	if (_fConnect > 0.f) connectTimeout = Timespan((Timespan::TimeDiff) (_fConnect * 1000000));
+	if (_fRead > 0.f) readTimeout = Timespan((Timespan::TimeDiff) (_fRead * 1000000));
+	if (_fTotal > 0.f) totalTimeout = Timespan((Timespan::TimeDiff) (_fTotal * 1000000));
+}
+
+bool ofxXivelyHistory::fetch(int _iDatastream, const DateTime& _start, const DateTime& _end, ofxXivelySeries& _series) {
+	_series.clear();
+	if (!(_start < _end))
+		return false;
+
+	/// split the range into pages
+	pPages.clear();
+	DateTime pageStart = _start;
+	while (pageStart < _end)
+	{
+		Page page;
+		page.start = pageStart;
+		page.end = pageStart + Timespan(iPageSeconds, 0);
+		if (_end < page.end)
+			page.end = _end;
+
+		pPages.push_back(page);
+		pageStart = page.end;
+	}
+
+	iDatastream = _iDatastream;
+	iNextPage = 0;
+	bFailed = false;
+
+	/// download them in parallel
+	int iThreads = MIN(iWorkers, (int) pPages.size());
+	vector<Worker*> workers;
+	vector<Thread*> threads;
+	for (int i = 0; i < iThreads; ++i)
+	{
+		workers.push_back(new Worker(*this));
+		threads.push_back(new Thread());
+		threads.back()->start(*workers.back());
+	}
+	for (int i = 0; i < iThreads; ++i)
+	{
+		threads[i]->join();
+		delete threads[i];
+		delete workers[i];
+	}
+
+	if (bFailed)
+	{
+		pPages.clear();
+		return false;
+	}
+
+	/// pages are in order and so is every page, just concatenate them
+	size_t iTotal = 0;
+	for (unsigned int i = 0; i < pPages.size(); ++i)
+		iTotal += pPages[i].pValues.size();
+
+	_series.pTimes.reserve(iTotal);
+	_series.pValues.reserve(iTotal);
+	for (unsigned int i = 0; i < pPages.size(); ++i)
+	{
+		Page& page = pPages[i];
+		for (unsigned int j = 0; j < page.pValues.size(); ++j)
+		{
+			/// pages may share the point sitting right on their boundary
+			if (!_series.pTimes.empty() && page.pTimes[j] <= _series.pTimes.back())
+				continue;
+
+			_series.pTimes.push_back(page.pTimes[j]);
+			_series.pValues.push_back(page.pValues[j]);
+		}
+	}
+
+	pPages.clear();
+	return true;
+}
+
+ofxXivelyHistory::Page* ofxXivelyHistory::nextPage() {
+	ofMutex::ScopedLock lock(mutex);
+	if (bFailed || iNextPage >= pPages.size())
+		return NULL;
+
+	return &pPages[iNextPage++];
+}
+
+void ofxXivelyHistory::Worker::run() {
+	Page* pPage;
+	while ((pPage = history.nextPage()) != NULL)
+	{
+		if (!fetchPage(*pPage))
+		{
+			ofMutex::ScopedLock lock(history.mutex);
+			history.bFailed = true;
+			return;
+		}
+	}
+}
+
+bool ofxXivelyHistory::Worker::fetchPage(Page& _page) {
+	DateTime from = _page.start;
+
+	while (true)
+	{
+		string sUrl = history.sApiUrl + ofToString(history.iFeedId) + "/datastreams/" + ofToString(history.iDatastream)
+			+ ".csv?start=" + DateTimeFormatter::format(from, "%Y-%m-%dT%H:%M:%S.%FZ")
+			+ "&end=" + DateTimeFormatter::format(_page.end, "%Y-%m-%dT%H:%M:%S.%FZ")
+			+ "&interval=0&limit=" + ofToString(OFX_XIVELY_HISTORY_LIMIT);
+
+		URI uri(sUrl);
+		HTTPSClientSession* pSession = NULL;
+		Timestamp start;
+		bool bFetched = false;
+		for (int iAttempt = 0; iAttempt < 2 && !bFetched; ++iAttempt)
+		{
+			bool bReused = false;
+			bool bResponseStarted = false;
+			try
+			{
+				pSession = ofxXivelySessionPool::instance().acquire(uri.getHost(), uri.getPort(),
+					ofxXivelyFeed::budget(history.connectTimeout, history.totalTimeout, start), bReused, iAttempt > 0);
+				/// only used if a pooled session has to reconnect
+				pSession->setTimeout(ofxXivelyFeed::budget(history.connectTimeout, history.totalTimeout, start));
+
+				HTTPRequest req(HTTPRequest::HTTP_GET, uri.getPathAndQuery(), HTTPMessage::HTTP_1_1);
+				req.setKeepAlive(true);
+				req.set("X-ApiKey", history.sApiKey);
+				pSession->sendRequest(req);
+
+				/// a reused session still carries the timeout of its first request
+				pSession->socket().setReceiveTimeout(ofxXivelyFeed::budget(history.readTimeout, history.totalTimeout, start));
+				HTTPResponse res;
+				istream& rs = pSession->receiveResponse(res);
+				bResponseStarted = true;
+				sBody.clear();
+				ofxXivelyFeed::readBody(*pSession, rs, sBody, history.readTimeout, history.totalTimeout, start);
+				ofxXivelySessionPool::instance().release(pSession, uri.getHost(), uri.getPort(), res.getKeepAlive());
+				pSession = NULL;
+
+				if (res.getStatus() != HTTPResponse::HTTP_OK)
+				{
+					ofLogError("ofxXively") << "history request failed with status " << res.getStatus() << ": " << sBody;
+					return false;
+				}
+				bFetched = true;
+			}
+			catch (Exception& exc)
+			{
+				ofxXivelySessionPool::instance().release(pSession, uri.getHost(), uri.getPort(), false);
+				pSession = NULL;
+
+				/// a pooled session the server had already closed, see ofxXivelyFeed::sendRequest()
+				if (bReused && !bResponseStarted && dynamic_cast<NetException*>(&exc) != NULL)
+				{
+					ofLogVerbose("ofxXively") << "pooled session was closed, retrying on a new one: " << exc.displayText();
+					continue;
+				}
+
+				ofLogError("ofxXively") << "Poco exception nr " << exc.code() << ": " << exc.displayText();
+				return false;
+			}
+		}
+
+		size_t iBefore = _page.pValues.size();
+		if (!parseCsv(sBody, _page.pTimes, _page.pValues))
+			return false;
+
+		if (_page.pValues.size() - iBefore < OFX_XIVELY_HISTORY_LIMIT)
+			return true;
+
+		/// the page was cut at the point limit, carry on right after its last point
+		from = DateTime(Timestamp((Timestamp::TimeVal) (_page.pTimes.back() * 1000000.0) + 1));
+		if (!(from < _page.end))
+			return true;
+	}
+}
+
+bool ofxXivelyHistory::parseCsv(const string& _csv, vector<double>& _times, vector<float>& _values) {
+	const char* pcLine = _csv.c_str();
+	while (*pcLine)
+	{
+		const char* pcComma = strchr(pcLine, ',');
+		const char* pcEnd = strchr(pcLine, '\n');
+		if (pcEnd == NULL)
+			pcEnd = pcLine + strlen(pcLine);
+
+		if (pcComma == NULL || pcComma > pcEnd)
+		{
+			/// tolerate blank lines, anything else is not ours
+			if (pcEnd - pcLine > 1)
+				return false;
+		}
+		else
+		{
+			double dTime;
+			if (!parseTime(pcLine, dTime))
+				return false;
+
+			_times.push_back(dTime);
+			_values.push_back((float) atof(pcComma + 1));
+		}
+
+		pcLine = *pcEnd ? pcEnd + 1 : pcEnd;
+	}
+
+	return true;
+}
+
+namespace {
+	int readDigits(const char*& _pc, int _iCount) {
+		int iValue = 0;
+		for (int i = 0; i < _iCount; ++i, ++_pc)
+		{
+			if (*_pc < '0' || *_pc > '9')
+				return -1;
+			iValue = iValue * 10 + (*_pc - '0');
+		}
+		return iValue;
+	}
+
+	long daysFromCivil(int _y, int _m, int _d) {
+		_y -= _m <= 2;
+		long era = (_y >= 0 ? _y : _y - 399) / 400;
+		long yoe = _y - era * 400;
+		long doy = (153 * (_m + (_m > 2 ? -3 : 9)) + 2) / 5 + _d - 1;
+		long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + doe - 719468;
+	}
+}
+
+bool ofxXivelyHistory::parseTime(const char* _pcTime, double& _dTime) {
+	/// 2013-04-10T10:20:30.123456Z, parsed by hand to keep it allocation free
+	const char* pc = _pcTime;
+	int y = readDigits(pc, 4);
+	if (y < 0 || *pc++ != '-') return false;
+	int m = readDigits(pc, 2);
+	if (m < 1 || *pc++ != '-') return false;
+	int d = readDigits(pc, 2);
+	if (d < 1 || *pc++ != 'T') return false;
+	int hh = readDigits(pc, 2);
+	if (hh < 0 || *pc++ != ':') return false;
+	int mm = readDigits(pc, 2);
+	if (mm < 0 || *pc++ != ':') return false;
+	int ss = readDigits(pc, 2);
+	if (ss < 0) return false;
+
+	_dTime = (double) daysFromCivil(y, m, d) * 86400.0 + hh * 3600 + mm * 60 + ss;
+
+	if (*pc == '.')
+	{
+		double dScale = 0.1;
+		for (++pc; *pc >= '0' && *pc <= '9'; ++pc, dScale *= 0.1)
+			_dTime += (*pc - '0') * dScale;
+	}
+
+	if (*pc == '+' || *pc == '-')
+	{
+		int iSign = *pc++ == '+' ? 1 : -1;
+		int iHours = readDigits(pc, 2);
+		if (*pc == ':') ++pc;
+		int iMinutes = readDigits(pc, 2);
+		if (iHours < 0 || iMinutes < 0) return false;
+		_dTime -= iSign * (iHours * 3600 + iMinutes * 60);
+	}
+
+	return true;
+}
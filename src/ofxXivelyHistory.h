@@ -0,0 +1,89 @@
+﻿#ifndef OFX_XIVELY_HISTORY_H
+#define OFX_XIVELY_HISTORY_H
+
+#include "ofMain.h"
+
+#include "ofxXivelyFeed.h"
+
+#include "Poco/DateTime.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+
+#define OFX_XIVELY_HISTORY_PAGE     21600   /// xively serves at most 6 hours of raw data per request
+#define OFX_XIVELY_HISTORY_LIMIT    1000    /// and at most this many points
+#define OFX_XIVELY_HISTORY_WORKERS  4
+
+/// Columnar time series, timestamps and values in two contiguous arrays
+/// so they can be handed to a mesh or plot as they are.
+struct ofxXivelySeries {
+	vector<double>	pTimes;             /// seconds since epoch, ascending
+	vector<float>	pValues;
+
+	int				size() { return pValues.size(); }
+	void			clear() {
+		pTimes.clear();
+		pValues.clear();
+	}
+};
+
+/// Downloads a datastream's history over a time range. The range is split
+/// into pages which are fetched in parallel over pooled keep-alive
+/// connections, and merged in timestamp order once all are done.
+class ofxXivelyHistory {
+public:
+	ofxXivelyHistory(string _sApiUrl, string _sApiKey, int _iFeedId);
+	~ofxXivelyHistory();
+
+	void					setWorkers(int _iWorkers);
+	void					setPageSeconds(int _iSeconds);
+	void					setTimeouts(float _fConnect, float _fRead, float _fTotal);
+	/// per page, same meaning and defaults as ofxXivelyFeed::setTimeouts()
+
+	bool					fetch(int _iDatastream, const DateTime& _start, const DateTime& _end, ofxXivelySeries& _series);
+	/// blocks until every page is in, call it from your own thread for long ranges
+
+	static bool				parseCsv(const string& _csv, vector<double>& _times, vector<float>& _values);
+	static bool				parseTime(const char* _pcTime, double& _dTime);
+
+private:
+	struct Page {
+		DateTime			start;
+		DateTime			end;
+		vector<double>		pTimes;
+		vector<float>		pValues;
+	};
+
+	class Worker : public Runnable {
+	public:
+		Worker(ofxXivelyHistory& _history) : history(_history) {}
+
+		void				run();
+
+	private:
+		bool				fetchPage(Page& _page);
+
+		ofxXivelyHistory&	history;
+		string				sBody;
+	};
+
+	Page*					nextPage();
+
+	string					sApiUrl;
+	string					sApiKey;
+	int						iFeedId;
+
+	int						iWorkers;
+	int						iPageSeconds;
+	Timespan				connectTimeout;
+	Timespan				readTimeout;
+	Timespan				totalTimeout;
+
+	int						iDatastream;
+	vector<Page>			pPages;
+	unsigned int			iNextPage;
+	bool					bFailed;
+	ofMutex					mutex;
+};
+
+#endif
@@ -2,31 +2,53 @@
 
 ofxXivelyInput::ofxXivelyInput(bool _bThreaded) : ofxXivelyFeed(_bThreaded) {
 	ofAddListener(responseEvent, this, &ofxXivelyInput::onResponse);
+	iTemplateMethod = OFX_XIVELY_PUT;
 	fLastInput = ofGetElapsedTimef();
+	iAggregation = OFX_XIVELY_AGGREGATE_LAST;
 }
 
 ofxXivelyInput::~ofxXivelyInput() {}
 
-string ofxXivelyInput::makeCsv()
+void ofxXivelyInput::makeCsv(string& sCsv)
 {
-	char pcCsv[1024];
-	pcCsv[0] = '\0';
+	/// fold everything sampled since the last upload into the value arrays,
+	/// under the lock readers on other threads take, like an output's responses
+	ofMutex::ScopedLock lock(mutex);
+	if (!pValues.empty()
+		&& aggregator.drain(&pValues[0], &pValueMins[0], &pValueMaxs[0], &pCounts[0], iAggregation))
+	{
+		for (int i = 0; i < (int) pData.size(); ++i)
+		{
+			pData[i].fValue = pValues[i];
+			pData[i].fValueMin = pValueMins[i];
+			pData[i].fValueMax = pValueMaxs[i];
+		}
+	}
 
-	bool bPrependComma = false;
-	for (itData = pData.begin(); itData != pData.end(); ++itData)
+	/// clear() keeps the capacity of the previous upload
+	sCsv.clear();
+	char pcValue[64];
+	for (int i = 0; i < (int) pValues.size(); ++i)
 	{
-		if (bPrependComma)
-			sprintf(pcCsv, "%s,\0", pcCsv);
-		else
-			bPrependComma = true;
+		if (i > 0)
+			sCsv += ',';
 
-		printf("%s%f\0", pcCsv, (*itData).fValue);
+		sprintf(pcValue, "%f", pValues[i]);
+		sCsv += pcValue;
 	}
-
-	return string(pcCsv);
 }
 
 bool ofxXivelyInput::input(int _format, bool _force) {
+	/// two callers would drain the aggregator and build the body at the same time
+	if (!inputMutex.tryLock())
+		return false;
+
+	bool bSubmitted = submitInput(_format, _force);
+	inputMutex.unlock();
+	return bSubmitted;
+}
+
+bool ofxXivelyInput::submitInput(int _format, bool _force) {
 	if (ofGetElapsedTimef() - fLastInput < fMinInterval && !_force)
 		return false;
 
@@ -41,15 +63,7 @@ bool ofxXivelyInput::input(int _format, bool _force) {
 
 	if (_format == OFX_XIVELY_CSV)
 	{
-		request.method = OFX_XIVELY_PUT;
-		request.format = OFX_XIVELY_CSV;
-		request.clearHeaders();
-		request.addHeader("X-ApiKey", sApiKey);
-		char pcUrl[256];
-		sprintf(pcUrl, "%s%d.csv", sApiUrl.c_str(), iFeedId);
-		request.url = pcUrl;
-		request.data = makeCsv();
-		request.timeout = 5;
+		makeCsv(sQueuedBody);
 	}
 	else
 	{
@@ -59,10 +73,7 @@ bool ofxXivelyInput::input(int _format, bool _force) {
 
 	fLastInput = ofGetElapsedTimef();
 
-	if (bThreaded)
-		bRequestQueued = true;
-	else
-		sendRequest(request);
+	submitRequest(_format);
 	return true;
 }
 
@@ -90,25 +101,74 @@ void ofxXivelyInput::onResponse(ofxXivelyResponse &response) {
 }
 
 void ofxXivelyInput::setDatastreamCount(int _datastreams) {
-	while (pData.size() > _datastreams)
-		pData.pop_back();
+	int iOldSize = pData.size();
+
+	ofxXivelyData data;
+	data.iId = 0;
+	data.fValue = 0.f;
+	data.fValueMin = 0.f;
+	data.fValueMax = 0.f;
+
+	/// one allocation for any number of new datastreams
+	pData.resize(_datastreams, data);
+	for (int i = iOldSize; i < _datastreams; ++i)
+		pData[i].iId = i;
+
+	pCounts.resize(_datastreams, 0);
+	syncValues();
+	aggregator.setSize(_datastreams);
+}
 
-	while (pData.size() < _datastreams)
-	{
-		ofxXivelyData data;
-		data.iId = pData.size();
-		data.fValue = 0.f;
-		data.fValueMin = 0.f;
-		data.fValueMax = 0.f;
+bool ofxXivelyInput::setValue(int _datastream, float _value) {
+	if (_datastream < 0 || _datastream >= aggregator.getSize())
+		return false;
 
-		pData.push_back(data);
-	}
+	aggregator.add(_datastream, _value);
+	return true;
 }
 
-bool ofxXivelyInput::setValue(int _datastream, float _value) {
-	if (_datastream >= pData.size())
+bool ofxXivelyInput::setValues(const float* _pValues, int _iCount, int _iFirst) {
+	if (_iFirst < 0 || _iCount < 0 || _iFirst > aggregator.getSize() - _iCount)
 		return false;
 
-	pData.at(_datastream).fValue = _value;
+	if (_iCount > 0)
+		aggregator.add(_iFirst, _pValues, _iCount);
 	return true;
 }
+
+bool ofxXivelyInput::setValueRanges(const float* _pMins, const float* _pMaxs, int _iCount, int _iFirst) {
+	if (_iFirst < 0 || _iCount < 0 || _iFirst > aggregator.getSize() - _iCount)
+		return false;
+
+	if (_iCount > 0)
+		aggregator.addRanges(_iFirst, _pMins, _pMaxs, _iCount);
+	return true;
+}
+
+float ofxXivelyInput::getPendingValue(int _datastream) {
+	if (_datastream < 0 || _datastream >= aggregator.getSize())
+		return 0.f;
+
+	/// nothing sampled since the last upload, it would resend the uploaded value
+	float fValue;
+	if (aggregator.peek(_datastream, iAggregation, fValue))
+		return fValue;
+
+	return pData[_datastream].fValue;
+}
+
+int ofxXivelyInput::getPendingValues(float* _pValues, int _iCount, int _iFirst) {
+	/// start from the uploaded values, the datastreams sampled since get overwritten
+	int iCount = getValues(_pValues, _iCount, _iFirst);
+	if (iCount > 0)
+		aggregator.peek(_iFirst, iCount, iAggregation, _pValues);
+
+	return iCount;
+}
+
+int ofxXivelyInput::getSampleCount(int _datastream) {
+	if (_datastream < 0 || _datastream >= (int) pCounts.size())
+		return 0;
+
+	return pCounts[_datastream];
+}
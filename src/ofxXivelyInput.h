@@ -4,6 +4,7 @@
 #include "ofMain.h"
 
 #include "ofxXivelyFeed.h"
+#include "ofxXivelyAggregator.h"
 
 #include <fstream>
 
@@ -13,14 +14,38 @@ public:
 	~ofxXivelyInput();
 
 	bool input(int _format = OFX_XIVELY_CSV, bool _force = false);
-	/// supports only CSV input at the moment
+	/// supports only CSV input at the moment. Returns false right away while another
+	/// thread is in input(), ie a manager's worker uploading this feed
 	void onResponse(ofxXivelyResponse& response);
 	void setDatastreamCount(int _datastrams);
+	/// not thread safe, call before samples start coming in
 	bool setValue(int _datastream, float _value);
+	/// may be called from any number of threads at sensor rate, each thread only
+	/// takes the uncontended lock of its own aggregation stripe
+	bool setValues(const float* _pValues, int _iCount, int _iFirst = 0);
+	/// datastreams _iFirst to _iFirst + _iCount - 1 in one go, all or nothing
+	bool setValueRanges(const float* _pMins, const float* _pMaxs, int _iCount, int _iFirst = 0);
+	/// widens the min/max the next upload reports for these datastreams, without adding
+	/// samples, for ranges kept elsewhere; all or nothing like setValues()
+	void setAggregation(int _mode) { iAggregation = _mode; }
+	/// OFX_XIVELY_AGGREGATE_LAST (default) or _MEAN of the samples since the last upload
+	int getSampleCount(int _datastream);
+	/// samples that went into the last upload
+	float getPendingValue(int _datastream);
+	int getPendingValues(float* _pValues, int _iCount, int _iFirst = 0);
+	/// what the next upload will send, ie the values just set, the bulk call returns how many were copied.
+	/// getValue() and getValues() return the last uploaded values instead, so they only
+	/// catch up with setValue() and setValues() after the next input() went through
 
 private:
-	string makeCsv();
+	bool submitInput(int _format, bool _force);
+	void makeCsv(string& sCsv);
+	ofMutex inputMutex;
 	float fLastInput;
+
+	ofxXivelyAggregator aggregator;
+	vector<int> pCounts;
+	int iAggregation;
 };
 
 #endif
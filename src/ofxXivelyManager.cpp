@@ -0,0 +1,349 @@
+﻿#include "ofxXivelyManager.h"
+
+#include "Poco/DOM/Element.h"
+
+ofxXivelyManager::ofxXivelyManager() {
+	bRunning = false;
+	iWorkers = OFX_XIVELY_WORKERS;
+	fInterval = OFX_XIVELY_MIN_INTERVAL;
+	sSnapshotDir = "xively";
+	iGeneration = 0;
+}
+
+ofxXivelyManager::~ofxXivelyManager() {
+	stop();
+
+	for (FeedMap::Iterator it = feeds.begin(); it != feeds.end(); ++it)
+	{
+		delete it->second->pFeed;
+		delete it->second;
+	}
+	feeds.clear();
+}
+
+void ofxXivelyManager::setWorkers(int _iWorkers) {
+	if (_iWorkers > 0)
+		iWorkers = _iWorkers;
+}
+
+void ofxXivelyManager::setInterval(float _fSeconds) {
+	if (_fSeconds > OFX_XIVELY_MIN_INTERVAL)
+		fInterval = _fSeconds;
+}
+
+bool ofxXivelyManager::loadConfig(string _sPath) {
+	try
+	{
+		DOMParser parser;
+		AutoPtr<Document> pDoc = parser.parse(ofToDataPath(_sPath, true));
+
+		NodeIterator itElem(pDoc, NodeFilter::SHOW_ELEMENT);
+		Node* pNode = itElem.nextNode();
+		while (pNode)
+		{
+			Element* pElement = static_cast<Element*>(pNode);
+
+			if (pNode->nodeName() == XMLString("xively"))
+			{
+				if (pElement->hasAttribute("apiKey"))
+					setApiKey(pElement->getAttribute("apiKey"));
+				if (pElement->hasAttribute("workers"))
+					setWorkers(ofToInt(pElement->getAttribute("workers")));
+				if (pElement->hasAttribute("interval"))
+					setInterval(ofToFloat(pElement->getAttribute("interval")));
+				if (pElement->hasAttribute("snapshotDir"))
+					setSnapshotDir(pElement->getAttribute("snapshotDir"));
+			}
+
+			if (pNode->nodeName() == XMLString("feed"))
+			{
+				int iFeedId = ofToInt(pElement->getAttribute("id"));
+				float fFeedInterval = pElement->hasAttribute("interval") ? ofToFloat(pElement->getAttribute("interval")) : -1.f;
+				string sFeedApiKey = pElement->getAttribute("apiKey");
+
+				bool bAdded;
+				if (pElement->getAttribute("mode") == "input")
+				{
+					int iDatastreams = ofToInt(pElement->getAttribute("datastreams"));
+					bAdded = addInput(iFeedId, iDatastreams, fFeedInterval, sFeedApiKey) != NULL;
+				}
+				else
+				{
+					int iFormat = pElement->getAttribute("format") == "eeml" ? OFX_XIVELY_EEML : OFX_XIVELY_CSV;
+					bAdded = addOutput(iFeedId, iFormat, fFeedInterval, sFeedApiKey, pElement->getAttribute("snapshotDir")) != NULL;
+				}
+
+				if (!bAdded)
+					ofLogWarning("ofxXively") << "feed " << iFeedId << " is declared twice in " << _sPath;
+			}
+
+			pNode = itElem.nextNode();
+		}
+	}
+	catch (Exception& exc)
+	{
+		ofLogError("ofxXively") << "couldn't load config " << _sPath << ": " << exc.displayText();
+		return false;
+	}
+
+	return true;
+}
+
+void ofxXivelyManager::start() {
+	if (bRunning)
+		return;
+
+	bRunning = true;
+	for (int i = 0; i < iWorkers; ++i)
+	{
+		workers.push_back(new Worker(*this));
+		threads.push_back(new Poco::Thread());
+		threads.back()->start(*workers.back());
+	}
+
+	startThread();
+}
+
+void ofxXivelyManager::stop() {
+	if (!bRunning)
+		return;
+
+	waitForThread(true);
+
+	mutex.lock();
+	bRunning = false;
+	readyCondition.broadcast();
+	mutex.unlock();
+
+	for (unsigned int i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+		delete threads[i];
+		delete workers[i];
+	}
+	threads.clear();
+	workers.clear();
+
+	/// whatever was still queued gets picked up again on the next start()
+	mutex.lock();
+	while (!ready.empty())
+	{
+		Entry* pEntry = ready.front();
+		ready.pop_front();
+
+		pEntry->bBusy = false;
+		if (pEntry->bRemoved)
+		{
+			delete pEntry->pFeed;
+			delete pEntry;
+		}
+	}
+	mutex.unlock();
+}
+
+ofxXivelyInput* ofxXivelyManager::addInput(int _iFeedId, int _iDatastreams, float _fInterval, string _sApiKey) {
+	ofxXivelyInput* pInput = new ofxXivelyInput(false);
+	pInput->setVerbose(false);
+	pInput->setDatastreamCount(_iDatastreams);
+
+	Entry* pEntry = new Entry();
+	pEntry->pFeed = pInput;
+	pEntry->pInput = pInput;
+	pEntry->pOutput = NULL;
+	pEntry->iFormat = OFX_XIVELY_CSV;
+	pEntry->fInterval = _fInterval;
+
+	if (!addEntry(_iFeedId, pEntry, _sApiKey))
+	{
+		delete pInput;
+		delete pEntry;
+		return NULL;
+	}
+
+	return pInput;
+}
+
+ofxXivelyOutput* ofxXivelyManager::addOutput(int _iFeedId, int _iFormat, float _fInterval, string _sApiKey, string _sSnapshotDir) {
+	ofxXivelyOutput* pOutput = new ofxXivelyOutput(false);
+	pOutput->setVerbose(false);
+	pOutput->setSnapshotDir(_sSnapshotDir == "" ? sSnapshotDir : _sSnapshotDir);
+
+	Entry* pEntry = new Entry();
+	pEntry->pFeed = pOutput;
+	pEntry->pInput = NULL;
+	pEntry->pOutput = pOutput;
+	pEntry->iFormat = _iFormat;
+	pEntry->fInterval = _fInterval;
+
+	if (!addEntry(_iFeedId, pEntry, _sApiKey))
+	{
+		delete pOutput;
+		delete pEntry;
+		return NULL;
+	}
+
+	return pOutput;
+}
+
+bool ofxXivelyManager::addEntry(int _iFeedId, Entry* _pEntry, string _sApiKey) {
+	if (_pEntry->fInterval < OFX_XIVELY_MIN_INTERVAL)
+		_pEntry->fInterval = fInterval;
+	_pEntry->bBusy = false;
+	_pEntry->bRemoved = false;
+
+	/// a duplicate shouldn't load a snapshot or prefetch anything
+	{
+		ofMutex::ScopedLock lock(mutex);
+		if (feeds.find(_iFeedId) != feeds.end())
+			return false;
+	}
+
+	_pEntry->pFeed->setApiKey(_sApiKey == "" ? sApiKey : _sApiKey);
+	_pEntry->pFeed->setFeedId(_iFeedId);
+
+	/// checked again, another thread may have added it in the meantime
+	ofMutex::ScopedLock lock(mutex);
+	if (feeds.find(_iFeedId) != feeds.end())
+		return false;
+
+	_pEntry->iGeneration = ++iGeneration;
+	feeds.insert(FeedMap::ValueType(_iFeedId, _pEntry));
+
+	/// read right away, but there is nothing to upload before a first interval
+	Due due;
+	due.fTime = ofGetElapsedTimef() + (_pEntry->pInput != NULL ? _pEntry->fInterval : 0.f);
+	due.iFeedId = _iFeedId;
+	due.iGeneration = _pEntry->iGeneration;
+	schedule.push(due);
+
+	return true;
+}
+
+bool ofxXivelyManager::removeFeed(int _iFeedId) {
+	Entry* pEntry;
+	{
+		ofMutex::ScopedLock lock(mutex);
+		FeedMap::Iterator it = feeds.find(_iFeedId);
+		if (it == feeds.end())
+			return false;
+
+		pEntry = it->second;
+		feeds.erase(it);
+
+		/// its worker deletes it when done, and its schedule entries are dropped lazily
+		if (pEntry->bBusy)
+		{
+			pEntry->bRemoved = true;
+			return true;
+		}
+	}
+
+	delete pEntry->pFeed;
+	delete pEntry;
+	return true;
+}
+
+ofxXivelyManager::Entry* ofxXivelyManager::findEntry(int _iFeedId) {
+	FeedMap::Iterator it = feeds.find(_iFeedId);
+	return it == feeds.end() ? NULL : it->second;
+}
+
+ofxXivelyFeed* ofxXivelyManager::getFeed(int _iFeedId) {
+	ofMutex::ScopedLock lock(mutex);
+	Entry* pEntry = findEntry(_iFeedId);
+	return pEntry == NULL ? NULL : pEntry->pFeed;
+}
+
+ofxXivelyInput* ofxXivelyManager::getInput(int _iFeedId) {
+	ofMutex::ScopedLock lock(mutex);
+	Entry* pEntry = findEntry(_iFeedId);
+	return pEntry == NULL ? NULL : pEntry->pInput;
+}
+
+ofxXivelyOutput* ofxXivelyManager::getOutput(int _iFeedId) {
+	ofMutex::ScopedLock lock(mutex);
+	Entry* pEntry = findEntry(_iFeedId);
+	return pEntry == NULL ? NULL : pEntry->pOutput;
+}
+
+int ofxXivelyManager::getFeedCount() {
+	ofMutex::ScopedLock lock(mutex);
+	return feeds.size();
+}
+
+void ofxXivelyManager::threadedFunction() {
+	ofLogVerbose("Xively") << "Scheduler started";
+
+	while (isThreadRunning())
+	{
+		float fWait = 0.1f;
+
+		mutex.lock();
+		float fNow = ofGetElapsedTimef();
+		while (!schedule.empty() && schedule.top().fTime <= fNow)
+		{
+			Due due = schedule.top();
+			schedule.pop();
+
+			Entry* pEntry = findEntry(due.iFeedId);
+			if (pEntry == NULL || pEntry->iGeneration != due.iGeneration)
+				continue;
+
+			due.fTime = fNow + pEntry->fInterval;
+			schedule.push(due);
+
+			/// a feed still busy with its last round just skips this one
+			if (pEntry->bBusy)
+				continue;
+
+			pEntry->bBusy = true;
+			ready.push_back(pEntry);
+			readyCondition.signal();
+		}
+
+		if (!schedule.empty())
+			fWait = MIN(fWait, schedule.top().fTime - fNow);
+		mutex.unlock();
+
+		ofSleepMillis(MAX(1, (int) (fWait * 1000)));
+	}
+}
+
+void ofxXivelyManager::work() {
+	while (true)
+	{
+		mutex.lock();
+		while (ready.empty() && bRunning)
+			readyCondition.wait(mutex);
+
+		if (!bRunning)
+		{
+			mutex.unlock();
+			return;
+		}
+
+		Entry* pEntry = ready.front();
+		ready.pop_front();
+		bool bSkip = pEntry->bRemoved;
+		mutex.unlock();
+
+		if (!bSkip)
+		{
+			if (pEntry->pOutput != NULL)
+				pEntry->pOutput->output(pEntry->iFormat, true);
+			else
+				pEntry->pInput->input(OFX_XIVELY_CSV, true);
+		}
+
+		mutex.lock();
+		pEntry->bBusy = false;
+		bool bDelete = pEntry->bRemoved;
+		mutex.unlock();
+
+		if (bDelete)
+		{
+			delete pEntry->pFeed;
+			delete pEntry;
+		}
+	}
+}
@@ -0,0 +1,113 @@
+﻿#ifndef OFX_XIVELY_MANAGER_H
+#define OFX_XIVELY_MANAGER_H
+
+#include "ofMain.h"
+
+#include "ofxXivelyInput.h"
+#include "ofxXivelyOutput.h"
+
+#include "Poco/HashMap.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Condition.h"
+
+#include <queue>
+#include <deque>
+
+#define OFX_XIVELY_WORKERS         4
+
+/// Owns any number of feeds and drives them from one scheduler thread and
+/// a small pool of worker threads, instead of a thread per feed. Feeds are
+/// created non-threaded and share the process wide connection pool.
+///
+/// Config file layout, attributes on <feed> override the ones on <xively>:
+///   <xively apiKey="..." workers="4" interval="10" snapshotDir="xively">
+///     <feed id="1543" mode="output" format="eeml" snapshotDir="..." />
+///     <feed id="143" mode="input" datastreams="2" interval="15" apiKey="..." />
+///   </xively>
+class ofxXivelyManager : public ofThread {
+public:
+	ofxXivelyManager();
+	~ofxXivelyManager();
+
+	bool					loadConfig(string _sPath);
+	/// relative to the data folder, adds every feed it declares
+	void					setApiKey(string _sApiKey) { sApiKey = _sApiKey; }
+	void					setWorkers(int _iWorkers);
+	void					setInterval(float _fSeconds);
+	void					setSnapshotDir(string _sDir) { sSnapshotDir = _sDir; }
+	/// defaults for feeds added afterwards, an empty snapshot dir disables output snapshots
+
+	void					start();
+	void					stop();
+
+	ofxXivelyInput*			addInput(int _iFeedId, int _iDatastreams, float _fInterval = -1.f, string _sApiKey = "");
+	ofxXivelyOutput*		addOutput(int _iFeedId, int _iFormat = OFX_XIVELY_CSV, float _fInterval = -1.f, string _sApiKey = "", string _sSnapshotDir = "");
+	/// NULL if the feed id is already managed, empty strings take the manager's defaults.
+	/// The workers call input() and output() on managed feeds, the app only feeds
+	/// samples in with setValue() and reads values back under the feed's lock()
+	bool					removeFeed(int _iFeedId);
+	/// pointers handed out for this feed are invalid afterwards
+
+	ofxXivelyFeed*			getFeed(int _iFeedId);
+	ofxXivelyInput*			getInput(int _iFeedId);
+	ofxXivelyOutput*		getOutput(int _iFeedId);
+	int						getFeedCount();
+	/// see addInput(), an input() of the app while a worker uploads the feed returns false
+
+protected:
+	void					threadedFunction();
+
+private:
+	struct Entry {
+		ofxXivelyFeed*		pFeed;
+		ofxXivelyInput*		pInput;
+		ofxXivelyOutput*	pOutput;
+		int					iFormat;
+		float				fInterval;
+		int					iGeneration;        /// tells a re-added feed from its removed namesake
+		bool				bBusy;              /// queued or being served by a worker
+		bool				bRemoved;           /// removed while busy, the worker deletes it
+	};
+
+	struct Due {
+		float				fTime;
+		int					iFeedId;
+		int					iGeneration;
+
+		bool operator<(const Due& _other) const { return fTime > _other.fTime; }
+		/// earliest first in a priority_queue
+	};
+
+	class Worker : public Runnable {
+	public:
+		Worker(ofxXivelyManager& _manager) : manager(_manager) {}
+		void				run() { manager.work(); }
+
+	private:
+		ofxXivelyManager&	manager;
+	};
+
+	bool					addEntry(int _iFeedId, Entry* _pEntry, string _sApiKey);
+	Entry*					findEntry(int _iFeedId);
+	void					work();
+
+	typedef Poco::HashMap<int, Entry*> FeedMap;
+	FeedMap					feeds;
+	priority_queue<Due>		schedule;
+	deque<Entry*>			ready;
+	ofMutex					mutex;
+	Poco::Condition			readyCondition;
+
+	vector<Worker*>			workers;
+	vector<Poco::Thread*>	threads;
+	bool					bRunning;
+
+	string					sApiKey;
+	string					sSnapshotDir;
+	int						iWorkers;
+	float					fInterval;
+	int						iGeneration;
+};
+
+#endif
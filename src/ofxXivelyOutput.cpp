@@ -3,9 +3,80 @@
 ofxXivelyOutput::ofxXivelyOutput(bool _bThreaded) : ofxXivelyFeed(_bThreaded) {
 	ofAddListener(responseEvent, this, &ofxXivelyOutput::onResponse);
 	fLastOutput = ofGetElapsedTimef();
+	fCacheTtl = 1.f;
+	bResponseParsed = false;
+	pSubscription = NULL;
+	sSnapshotDir = "xively";
+	fLastSnapshot = -OFX_XIVELY_SNAPSHOT_INTERVAL;
+	bSnapshotDirty = false;
 }
 
-ofxXivelyOutput::~ofxXivelyOutput() {}
+ofxXivelyOutput::~ofxXivelyOutput() {
+	unsubscribe();
+
+	ofMutex::ScopedLock lock(mutex);
+	if (bSnapshotDirty)
+		saveSnapshot();
+}
+
+void ofxXivelyOutput::setFeedId(int _iId) {
+	ofxXivelyFeed::setFeedId(_iId);
+
+	ofxXivelySnapshot snapshot;
+	if (sSnapshotDir != "" && ofxXivelyDiskCache::load(getSnapshotPath(), iFeedId, snapshot))
+	{
+		if (bVerbose) printf("[Xively] restored feed %d from snapshot\n", iFeedId);
+		applySnapshot(snapshot, OFX_XIVELY_EEML);
+		pSnapshotValues = pValues;
+		sSnapshotUpdated = sUpdated;
+	}
+}
+
+void ofxXivelyOutput::saveSnapshot() {
+	/// called with mutex held
+	ofxXivelySnapshot snapshot;
+	makeSnapshot(snapshot);
+	ofxXivelyDiskCache::save(getSnapshotPath(), iFeedId, snapshot);
+
+	pSnapshotValues = pValues;
+	sSnapshotUpdated = sUpdated;
+	fLastSnapshot = ofGetElapsedTimef();
+	bSnapshotDirty = false;
+}
+
+string ofxXivelyOutput::getSnapshotPath() {
+	return ofToDataPath(sSnapshotDir + "/" + ofToString(iFeedId) + ".bin", true);
+}
+
+bool ofxXivelyOutput::subscribe(string _sHost, int _iPort, bool _bSecure) {
+	if (sApiKey == "" || iFeedId == -1)
+	{
+		bLastRequestOk = false;
+		return false;
+	}
+
+	if (pSubscription == NULL)
+		pSubscription = new ofxXivelySubscription(responseEvent);
+	pSubscription->start(iFeedId, sApiKey, _sHost, _iPort, _bSecure);
+	return true;
+}
+
+void ofxXivelyOutput::unsubscribe() {
+	if (pSubscription == NULL)
+		return;
+
+	delete pSubscription;
+	pSubscription = NULL;
+}
+
+bool ofxXivelyOutput::getHistory(int _iDatastream, const DateTime& _start, const DateTime& _end, ofxXivelySeries& _series) {
+	if (sApiKey == "" || iFeedId == -1)
+		return false;
+
+	ofxXivelyHistory history(sApiUrl, sApiKey, iFeedId);
+	history.setTimeouts(fConnectTimeout, fReadTimeout, fTotalTimeout);
+	return history.fetch(_iDatastream, _start, _end, _series);
+}
 
 bool ofxXivelyOutput::output(int _format, bool _force) {
 	if (ofGetElapsedTimef() - fLastOutput < fMinInterval && !_force)
@@ -14,47 +85,107 @@ bool ofxXivelyOutput::output(int _format, bool _force) {
 	if (bThreaded && bRequestQueued)
 		return false;
 
+	/// the subscription already delivers every update
+	if (pSubscription != NULL)
+		return false;
+
 	if (sApiKey == "" || iFeedId == -1)
 	{
 		bLastRequestOk = false;
 		return false;
 	}
 
-	if (_format == OFX_XIVELY_CSV)
+	if (_format != OFX_XIVELY_CSV && _format != OFX_XIVELY_EEML)
+	{
+		/// unrecognized format
+		return false;
+	}
+
+	fLastOutput = ofGetElapsedTimef();
+
+	/// reads send no body, queuing one cancels the read still in flight
+	sQueuedBody.clear();
+	submitRequest(_format);
+	return true;
+}
+
+void ofxXivelyOutput::processRequest(const ofxXivelyRequest& _request, const string& _sBody) {
+	/// feeds read with different keys may not see the same datastreams
+	const string& sKey = _request.key;
+	ofxXivelySnapshotPtr pSnapshot;
+
+	int iResult = ofxXivelyCache::instance().join(sKey, pSnapshot, fCacheTtl);
+	if (iResult == OFX_XIVELY_CACHE_HIT)
 	{
-		request.method = OFX_XIVELY_GET;
-		request.format = OFX_XIVELY_CSV;
-		request.clearHeaders();
-		request.addHeader("X-ApiKey", sApiKey);
-		char pcUrl[256];
-		sprintf(pcUrl, "%s%d.csv", sApiUrl.c_str(), iFeedId);
-		request.url = pcUrl;
-		request.timeout = 5;
+		if (bVerbose) printf("[Xively] served from shared cache\n");
+		ofMutex::ScopedLock lock(mutex);
+		applySnapshot(*pSnapshot, _request.format);
+		bLastRequestOk = true;
+		fLastResponseTime = ofGetElapsedTimef();
+		return;
 	}
-	else if (_format == OFX_XIVELY_EEML)
+	if (iResult == OFX_XIVELY_CACHE_FAILED)
 	{
-		request.method = OFX_XIVELY_GET;
-		request.format = OFX_XIVELY_EEML;
-		request.clearHeaders();
-		request.addHeader("X-ApiKey", sApiKey);
-		char pcUrl[256];
-		sprintf(pcUrl, "%s%d.xml", sApiUrl.c_str(), iFeedId);
-		request.url = pcUrl;
-		request.timeout = 5;
+		bLastRequestOk = false;
+		return;
+	}
+
+	/// we are the leader for this feed, do the request and share the result
+	bResponseParsed = false;
+	sendRequest(_request, _sBody);
+
+	if (bResponseParsed)
+	{
+		ofxXivelySnapshot* pNew = new ofxXivelySnapshot();
+		mutex.lock();
+		makeSnapshot(*pNew);
+		mutex.unlock();
+		ofxXivelyCache::instance().publish(sKey, ofxXivelySnapshotPtr(pNew));
 	}
 	else
 	{
-		/// unrecognized format
-		return false;
+		ofxXivelyCache::instance().abandon(sKey, wasSuperseded());
 	}
+}
 
-	fLastOutput = ofGetElapsedTimef();
+void ofxXivelyOutput::makeSnapshot(ofxXivelySnapshot& _snapshot) {
+	_snapshot.pData = pData;
+	_snapshot.location = location;
+	_snapshot.sTitle = sTitle;
+	_snapshot.sStatus = sStatus;
+	_snapshot.sDescription = sDescription;
+	_snapshot.sWebsite = sWebsite;
+	_snapshot.sUpdated = sUpdated;
+}
 
-	if (bThreaded)
-		bRequestQueued = true;
+void ofxXivelyOutput::applySnapshot(const ofxXivelySnapshot& _snapshot, int _format) {
+	if (_format == OFX_XIVELY_EEML)
+	{
+		pData = _snapshot.pData;
+		location = _snapshot.location;
+		sTitle = _snapshot.sTitle;
+		sStatus = _snapshot.sStatus;
+		sDescription = _snapshot.sDescription;
+		sWebsite = _snapshot.sWebsite;
+		sUpdated = _snapshot.sUpdated;
+	}
 	else
-		sendRequest(request);
-	return true;
+	{
+		/// csv only carries values, keep everything else we know about the feed
+		for (unsigned int i = 0; i < _snapshot.pData.size(); ++i)
+		{
+			if (pData.size() <= i)
+			{
+				ofxXivelyData d;
+				d.iId = i;
+				pData.push_back(d);
+			}
+
+			pData.at(i).fValue = _snapshot.pData.at(i).fValue;
+		}
+	}
+
+	syncValues();
 }
 
 bool ofxXivelyOutput::parseResponseCsv(string _response) {
@@ -178,7 +309,65 @@ bool ofxXivelyOutput::parseResponseEeml(string _response) {
 	return true;
 }
 
+bool ofxXivelyOutput::parseResponseJson(string _response) {
+	string sValue = ofxXivelySubscription::jsonValue(_response, "updated");
+	if (sValue != "")
+		sUpdated = sValue;
+
+	size_t iPos = _response.find("\"datastreams\"");
+	if (iPos == string::npos)
+		return true;
+
+	iPos = _response.find('[', iPos);
+	if (iPos == string::npos)
+		return false;
+
+	/// walk the datastream objects until the end of the array
+	iPos = _response.find_first_not_of(" \t\r\n", iPos + 1);
+	while (iPos != string::npos && _response.at(iPos) == '{')
+	{
+		size_t iEnd = ofxXivelySubscription::jsonObjectEnd(_response, iPos);
+		if (iEnd == string::npos)
+			return false;
+
+		string sStream = _response.substr(iPos, iEnd - iPos + 1);
+		int iId = atoi(ofxXivelySubscription::jsonValue(sStream, "id").c_str());
+
+		for (itData = pData.begin(); itData != pData.end(); ++itData)
+			if ((*itData).iId == iId)
+				break;
+
+		if (itData == pData.end())
+		{
+			ofxXivelyData data;
+			data.iId = iId;
+			data.fValue = 0.f;
+			data.fValueMin = 0.f;
+			data.fValueMax = 0.f;
+			pData.push_back(data);
+			itData = pData.end() - 1;
+		}
+
+		sValue = ofxXivelySubscription::jsonValue(sStream, "current_value");
+		if (sValue != "")
+			(*itData).fValue = atof(sValue.c_str());
+		sValue = ofxXivelySubscription::jsonValue(sStream, "min_value");
+		if (sValue != "")
+			(*itData).fValueMin = atof(sValue.c_str());
+		sValue = ofxXivelySubscription::jsonValue(sStream, "max_value");
+		if (sValue != "")
+			(*itData).fValueMax = atof(sValue.c_str());
+
+		iPos = _response.find_first_not_of(" \t\r\n,", iEnd + 1);
+	}
+
+	return true;
+}
+
 void ofxXivelyOutput::onResponse(ofxXivelyResponse &response) {
+	/// polled responses come from the feed thread, pushed ones from the subscription thread
+	ofMutex::ScopedLock lock(mutex);
+
 	if (bVerbose)
 	{
 		printf("[Xively] received response with status %d\n", response.status);
@@ -188,16 +377,32 @@ void ofxXivelyOutput::onResponse(ofxXivelyResponse &response) {
 
 	if (response.status == 200)
 	{
-		bool bParsedOk;
+		bool bParsedOk = false;
 		if (response.format == OFX_XIVELY_CSV)
 			bParsedOk = parseResponseCsv(response.responseBody);
 		else if (response.format == OFX_XIVELY_EEML)
 			bParsedOk = parseResponseEeml(response.responseBody);
+		else if (response.format == OFX_XIVELY_JSON)
+			bParsedOk = parseResponseJson(response.responseBody);
 
 		if (bParsedOk)
 		{
+			syncValues();
+
+			/// only a polled response may be published to the cache by its leader
+			if (response.format != OFX_XIVELY_JSON)
+				bResponseParsed = true;
 			bLastRequestOk = true;
 			fLastResponseTime = ofGetElapsedTimef();
+
+			/// a feed polled every few seconds mostly answers with what it said before
+			if (sSnapshotDir != "")
+			{
+				if (pValues != pSnapshotValues || sUpdated != sSnapshotUpdated)
+					bSnapshotDirty = true;
+				if (bSnapshotDirty && ofGetElapsedTimef() - fLastSnapshot >= OFX_XIVELY_SNAPSHOT_INTERVAL)
+					saveSnapshot();
+			}
 		}
 		else
 		{
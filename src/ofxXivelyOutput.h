@@ -4,6 +4,10 @@
 #include "ofMain.h"
 
 #include "ofxXivelyFeed.h"
+#include "ofxXivelyCache.h"
+#include "ofxXivelySubscription.h"
+#include "ofxXivelyHistory.h"
+#include "ofxXivelyDiskCache.h"
 
 #include "Poco/DOM/DOMParser.h"
 #include "Poco/DOM/Document.h"
@@ -17,6 +21,8 @@
 
 #include <fstream>
 
+#define OFX_XIVELY_SNAPSHOT_INTERVAL 30    /// seconds at least between two snapshot writes of a feed
+
 using namespace std;
 using namespace Poco::XML;
 using namespace Poco;
@@ -27,10 +33,31 @@ public:
 	ofxXivelyOutput(bool _bThreaded = true);
 	~ofxXivelyOutput();
 
+	void setFeedId(int _iId);
+	/// also restores the last known state of the feed from its snapshot file
+	void setSnapshotDir(string _sDir) { sSnapshotDir = _sDir; }
+	/// relative to the data folder, set before setFeedId, empty disables snapshots.
+	/// Written when the values changed, at most every OFX_XIVELY_SNAPSHOT_INTERVAL
+	/// seconds, and once more on destruction if the last change wasn't written yet
+
 	bool output(int _format = OFX_XIVELY_CSV, bool _force = false);
 	bool parseResponseEeml(string _response);
 	bool parseResponseCsv(string _response);
+	bool parseResponseJson(string _response);
 	void onResponse(ofxXivelyResponse& response);
+	void setCacheTtl(float fSeconds) { fCacheTtl = fSeconds; }
+	/// reads of the same feed within this time are served from the shared cache
+
+	bool subscribe(string _sHost = OFX_XIVELY_SOCKET_HOST, int _iPort = OFX_XIVELY_SOCKET_PORT, bool _bSecure = true);
+	/// push mode: updates are applied as they arrive on the subscription thread,
+	/// output() refuses to poll meanwhile. Wrap reads of the feed in lock() / unlock()
+	/// while subscribed. The endpoint defaults to the Xively socket server
+	void unsubscribe();
+	bool isSubscribed() { return pSubscription != NULL; }
+	ofxXivelySubscription* getSubscription() { return pSubscription; }
+
+	bool getHistory(int _iDatastream, const DateTime& _start, const DateTime& _end, ofxXivelySeries& _series);
+	/// blocking, large ranges are fetched in parallel pages
 
 	ofxXivelyLocation&	getLocation() { return location; }
 	string& getTitle() { return sTitle; }
@@ -39,7 +66,14 @@ public:
 	string&	getWebsite() { return sWebsite; }
 	string& getUpdated() { return sUpdated; }
 
+protected:
+	void processRequest(const ofxXivelyRequest& _request, const string& _sBody);
+
 private:
+	void makeSnapshot(ofxXivelySnapshot& _snapshot);
+	void applySnapshot(const ofxXivelySnapshot& _snapshot, int _format);
+	void saveSnapshot();
+	string getSnapshotPath();
 
 	/// INFO ABOUT FEED ->
 	string sTitle;
@@ -52,6 +86,15 @@ private:
 	/// <- INFO
 
 	float fLastOutput;
+	float fCacheTtl;
+	ofxXivelySubscription* pSubscription;
+	string sSnapshotDir;
+	float fLastSnapshot;
+	bool bSnapshotDirty;
+	vector<float> pSnapshotValues;
+	string sSnapshotUpdated;
+	/// what the snapshot file holds, to tell whether a response changed anything
+	bool bResponseParsed;
 };
 
 #endif
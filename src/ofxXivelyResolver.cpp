@@ -0,0 +1,131 @@
+﻿#include "ofxXivelyResolver.h"
+
+namespace {
+	Poco::SingletonHolder<ofxXivelyResolver> resolverHolder;
+}
+
+ofxXivelyResolver& ofxXivelyResolver::instance() {
+	return *resolverHolder.get();
+}
+
+ofxXivelyResolver::ofxXivelyResolver() {
+	bRunning = false;
+	iTtl = (Timestamp::TimeDiff) OFX_XIVELY_DNS_TTL * 1000000;
+}
+
+ofxXivelyResolver::~ofxXivelyResolver() {
+	mutex.lock();
+	bool bJoin = bRunning;
+	bRunning = false;
+	wakeCondition.signal();
+	mutex.unlock();
+
+	if (bJoin)
+		thread.join();
+}
+
+void ofxXivelyResolver::setTtl(float _fSeconds) {
+	ofMutex::ScopedLock lock(mutex);
+	iTtl = (Timestamp::TimeDiff) (_fSeconds * 1000000);
+}
+
+void ofxXivelyResolver::start() {
+	/// called with the mutex held
+	if (bRunning)
+		return;
+
+	bRunning = true;
+	thread.start(*this);
+}
+
+void ofxXivelyResolver::prefetch(const string& _sHost) {
+	ofMutex::ScopedLock lock(mutex);
+	if (entries.find(_sHost) != entries.end())
+		return;
+
+	entries[_sHost];
+	start();
+	wakeCondition.signal();
+}
+
+vector<string> ofxXivelyResolver::addresses(const string& _sHost) {
+	ofMutex::ScopedLock lock(mutex);
+	map<string, Entry>::iterator it = entries.find(_sHost);
+	if (it == entries.end())
+	{
+		entries[_sHost];
+		start();
+		wakeCondition.signal();
+		return vector<string>();
+	}
+
+	return it->second.pAddresses;
+}
+
+void ofxXivelyResolver::demote(const string& _sHost, const string& _sAddress) {
+	ofMutex::ScopedLock lock(mutex);
+	map<string, Entry>::iterator it = entries.find(_sHost);
+	if (it == entries.end())
+		return;
+
+	vector<string>& addresses = it->second.pAddresses;
+	vector<string>::iterator itAddress = find(addresses.begin(), addresses.end(), _sAddress);
+	if (itAddress == addresses.end())
+		return;
+
+	addresses.erase(itAddress);
+	addresses.push_back(_sAddress);
+}
+
+bool ofxXivelyResolver::lookup(const string& _sHost, vector<string>& _addresses) {
+	try
+	{
+		const HostEntry::AddressList& list = DNS::hostByName(_sHost).addresses();
+		for (unsigned int i = 0; i < list.size(); ++i)
+			_addresses.push_back(list[i].toString());
+	}
+	catch (Exception& exc)
+	{
+		ofLogWarning("ofxXively") << "couldn't resolve " << _sHost << ": " << exc.displayText();
+		return false;
+	}
+
+	return !_addresses.empty();
+}
+
+void ofxXivelyResolver::run() {
+	mutex.lock();
+	while (bRunning)
+	{
+		Timestamp now;
+		vector<string> pDue;
+		for (map<string, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+			if (it->second.nextRefresh <= now)
+				pDue.push_back(it->first);
+
+		for (unsigned int i = 0; i < pDue.size() && bRunning; ++i)
+		{
+			mutex.unlock();
+			vector<string> pAddresses;
+			bool bResolved = lookup(pDue[i], pAddresses);
+			mutex.lock();
+
+			/// refresh at 80% of the ttl so the entry never runs stale while in use
+			Entry& entry = entries[pDue[i]];
+			entry.nextRefresh.update();
+			if (bResolved)
+			{
+				entry.pAddresses = pAddresses;
+				entry.nextRefresh = entry.nextRefresh + iTtl / 5 * 4;
+			}
+			else
+			{
+				entry.nextRefresh = entry.nextRefresh + (Timestamp::TimeDiff) OFX_XIVELY_DNS_RETRY * 1000000;
+			}
+		}
+
+		if (bRunning)
+			wakeCondition.tryWait(mutex, 1000);
+	}
+	mutex.unlock();
+}
@@ -0,0 +1,60 @@
+﻿#ifndef OFX_XIVELY_RESOLVER_H
+#define OFX_XIVELY_RESOLVER_H
+
+#include "ofMain.h"
+
+#include "Poco/Net/DNS.h"
+#include "Poco/Net/HostEntry.h"
+#include "Poco/Net/IPAddress.h"
+#include "Poco/SingletonHolder.h"
+#include "Poco/Condition.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+
+#define OFX_XIVELY_DNS_TTL         300     /// seconds a lookup is trusted
+#define OFX_XIVELY_DNS_RETRY       5       /// seconds before a failed lookup is tried again
+
+using namespace std;
+using namespace Poco::Net;
+using namespace Poco;
+
+/// Process wide DNS cache. Lookups run on a background thread and are
+/// refreshed before they expire, so requests never wait on the resolver
+/// once a host has been seen. When a refresh fails the last known
+/// addresses keep being served.
+class ofxXivelyResolver : public Runnable {
+public:
+	ofxXivelyResolver();
+	~ofxXivelyResolver();
+
+	static ofxXivelyResolver& instance();
+
+	void					prefetch(const string& _sHost);
+	/// starts resolving in the background, cheap if the host is already known
+	vector<string>			addresses(const string& _sHost);
+	/// every known address, preferred first, empty while the first lookup is pending
+	void					demote(const string& _sHost, const string& _sAddress);
+	/// a connection to this address failed, prefer the next one
+	void					setTtl(float _fSeconds);
+
+	void					run();
+
+private:
+	struct Entry {
+		vector<string>		pAddresses;
+		Timestamp			nextRefresh;
+	};
+
+	void					start();
+	bool					lookup(const string& _sHost, vector<string>& _addresses);
+
+	map<string, Entry>		entries;
+	ofMutex					mutex;
+	Poco::Condition			wakeCondition;
+	Poco::Thread			thread;
+	bool					bRunning;
+	Timestamp::TimeDiff		iTtl;
+};
+
+#endif
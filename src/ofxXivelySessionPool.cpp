@@ -0,0 +1,100 @@
+﻿#include "ofxXivelySessionPool.h"
+
+namespace {
+	Poco::SingletonHolder<ofxXivelySessionPool> poolHolder;
+}
+
+ofxXivelySessionPool& ofxXivelySessionPool::instance() {
+	return *poolHolder.get();
+}
+
+ofxXivelySessionPool::~ofxXivelySessionPool() {
+	map<string, vector<Idle> >::iterator it;
+	for (it = idle.begin(); it != idle.end(); ++it)
+		for (unsigned int i = 0; i < it->second.size(); ++i)
+			delete it->second[i].pSession;
+}
+
+HTTPSClientSession* ofxXivelySessionPool::acquire(const string& _sHost, int _iPort, const Timespan& _connectBudget, bool& _bReused, bool _bFresh) {
+	string sKey = _sHost + ":" + ofToString(_iPort);
+	_bReused = false;
+	if (!_bFresh)
+	{
+		ofMutex::ScopedLock lock(mutex);
+		vector<Idle>& sessions = idle[sKey];
+		while (!sessions.empty())
+		{
+			Idle last = sessions.back();
+			sessions.pop_back();
+
+			/// the server has most likely closed it by now
+			if (last.lastUsed.isElapsed((Timestamp::TimeDiff) OFX_XIVELY_KEEP_ALIVE * 1000000))
+			{
+				delete last.pSession;
+				continue;
+			}
+
+			_bReused = true;
+			return last.pSession;
+		}
+	}
+
+	/// connecting to a cached address keeps name lookups off the request path
+	vector<string> pAddresses = ofxXivelyResolver::instance().addresses(_sHost);
+	if (pAddresses.empty())
+	{
+		/// the first lookup is still pending, the session resolves the name itself
+		ofxXivelySession* pSession = new ofxXivelySession(_sHost, _iPort);
+		pSession->setKeepAlive(true);
+		pSession->setTimeout(_connectBudget);
+		return pSession;
+	}
+
+	Timestamp start;
+	string sError;
+	for (unsigned int i = 0; i < pAddresses.size(); ++i)
+	{
+		Timespan remaining = _connectBudget - Timespan(start.elapsed());
+		if (remaining.totalMicroseconds() <= 0)
+			throw TimeoutException("connect deadline exceeded for " + _sHost);
+
+		ofxXivelySession* pSession = new ofxXivelySession(_sHost, _iPort);
+		pSession->setKeepAlive(true);
+		pSession->setTimeout(remaining);
+		try
+		{
+			pSession->connectTo(SocketAddress(pAddresses[i], _iPort));
+			return pSession;
+		}
+		catch (Exception& exc)
+		{
+			/// try the next address, and prefer it from now on
+			ofLogWarning("ofxXively") << "couldn't connect to " << _sHost << " at " << pAddresses[i] << ": " << exc.displayText();
+			ofxXivelyResolver::instance().demote(_sHost, pAddresses[i]);
+			sError = exc.displayText();
+			delete pSession;
+		}
+	}
+
+	throw NetException("couldn't connect to " + _sHost + ": " + sError);
+}
+
+void ofxXivelySessionPool::release(HTTPSClientSession* _pSession, const string& _sHost, int _iPort, bool _bReusable) {
+	if (_pSession == NULL)
+		return;
+
+	if (_bReusable)
+	{
+		ofMutex::ScopedLock lock(mutex);
+		vector<Idle>& sessions = idle[_sHost + ":" + ofToString(_iPort)];
+		if (sessions.size() < OFX_XIVELY_MAX_IDLE)
+		{
+			Idle entry;
+			entry.pSession = _pSession;
+			sessions.push_back(entry);
+			return;
+		}
+	}
+
+	delete _pSession;
+}
@@ -0,0 +1,55 @@
+﻿#ifndef OFX_XIVELY_SESSION_POOL_H
+#define OFX_XIVELY_SESSION_POOL_H
+
+#include "ofMain.h"
+
+#include "Poco/Net/HTTPSClientSession.h"
+#include "Poco/SingletonHolder.h"
+#include "Poco/Timestamp.h"
+
+#include "ofxXivelyResolver.h"
+
+#define OFX_XIVELY_KEEP_ALIVE      5       /// seconds an idle connection is kept
+#define OFX_XIVELY_MAX_IDLE        16      /// idle connections kept per host
+
+using namespace std;
+using namespace Poco::Net;
+using namespace Poco;
+
+/// A session that is told its host name, for the Host header and the tls
+/// peer name, but connects to an address picked by the resolver.
+class ofxXivelySession : public HTTPSClientSession {
+public:
+	ofxXivelySession(const string& _sHost, int _iPort) : HTTPSClientSession(_sHost, _iPort) {}
+
+	void					connectTo(const SocketAddress& _address) { connect(_address); }
+};
+
+/// Process wide pool of keep-alive https sessions shared by every feed.
+class ofxXivelySessionPool {
+public:
+	ofxXivelySessionPool() {}
+	~ofxXivelySessionPool();
+
+	static ofxXivelySessionPool& instance();
+
+	HTTPSClientSession*		acquire(const string& _sHost, int _iPort, const Timespan& _connectBudget, bool& _bReused, bool _bFresh = false);
+	/// an idle session to this host, or a new one connected to the first of
+	/// its cached addresses that answers within the budget, throws if none does.
+	/// _bReused tells which it was; the server may have closed an idle one in the
+	/// meantime, so a request failing on it before any response can be retried
+	/// once with _bFresh, which skips the idle sessions
+	void					release(HTTPSClientSession* _pSession, const string& _sHost, int _iPort, bool _bReusable);
+	/// hand it back after the response body has been read, or pass false to drop it
+
+private:
+	struct Idle {
+		HTTPSClientSession*	pSession;
+		Timestamp			lastUsed;
+	};
+
+	map<string, vector<Idle> > idle;
+	ofMutex					mutex;
+};
+
+#endif
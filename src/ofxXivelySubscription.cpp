@@ -0,0 +1,290 @@
+﻿#include "ofxXivelySubscription.h"
+
+ofxXivelySubscription::ofxXivelySubscription(ofEvent<ofxXivelyResponse>& _responseEvent) : responseEvent(_responseEvent) {
+	sHost = OFX_XIVELY_SOCKET_HOST;
+	iPort = OFX_XIVELY_SOCKET_PORT;
+	bSecure = true;
+
+	iFeedId = -1;
+	bConnected = false;
+}
+
+ofxXivelySubscription::~ofxXivelySubscription() {
+	stop();
+}
+
+void ofxXivelySubscription::start(int _iFeedId, string _sApiKey, string _sHost, int _iPort, bool _bSecure) {
+	stop();
+
+	/// only touched while the thread is stopped
+	sHost = _sHost;
+	iPort = _iPort;
+	bSecure = _bSecure;
+	iFeedId = _iFeedId;
+	sApiKey = _sApiKey;
+	sResource = "/feeds/" + ofToString(iFeedId);
+
+	lock();
+	sLastUpdated = "";
+	unlock();
+
+	startThread();
+}
+
+void ofxXivelySubscription::stop() {
+	if (isThreadRunning())
+		waitForThread(true);
+	bConnected = false;
+}
+
+string ofxXivelySubscription::getLastUpdated() {
+	lock();
+	string sUpdated = sLastUpdated;
+	unlock();
+	return sUpdated;
+}
+
+void ofxXivelySubscription::threadedFunction() {
+	ofLogVerbose("Xively") << "Subscription thread started";
+
+	int iBackoff = 1;
+	char pcBuffer[4096];
+
+	while (isThreadRunning())
+	{
+		StreamSocket socket;
+		if (!connect(socket))
+		{
+			/// wait before trying again, but keep stop() responsive
+			for (int i = 0; i < iBackoff * 10 && isThreadRunning(); ++i)
+				ofSleepMillis(100);
+			iBackoff = MIN(iBackoff * 2, OFX_XIVELY_MAX_BACKOFF);
+			continue;
+		}
+
+		iBackoff = 1;
+		string sPending;
+
+		while (isThreadRunning())
+		{
+			int iReceived;
+			try
+			{
+				iReceived = socket.receiveBytes(pcBuffer, sizeof(pcBuffer));
+			}
+			catch (TimeoutException&)
+			{
+				/// idle connection, nothing has changed
+				continue;
+			}
+			catch (Exception& exc)
+			{
+				ofLogError("ofxXively") << "subscription lost: " << exc.displayText();
+				break;
+			}
+
+			if (iReceived <= 0)
+			{
+				ofLogWarning("ofxXively") << "subscription closed by server";
+				break;
+			}
+
+			sPending.append(pcBuffer, iReceived);
+
+			/// pass on every complete message, keep the rest for later
+			size_t iStart = sPending.find('{');
+			while (iStart != string::npos)
+			{
+				size_t iEnd = jsonObjectEnd(sPending, iStart);
+				if (iEnd == string::npos)
+					break;
+
+				handleMessage(sPending.substr(iStart, iEnd - iStart + 1));
+				iStart = sPending.find('{', iEnd + 1);
+			}
+			sPending = iStart == string::npos ? "" : sPending.substr(iStart);
+		}
+
+		bConnected = false;
+		try
+		{
+			socket.close();
+		}
+		catch (Exception&) {}
+	}
+}
+
+bool ofxXivelySubscription::connect(StreamSocket& _socket) {
+	/// cached addresses in order of preference, or the name itself while the first lookup is pending
+	vector<string> pAddresses = ofxXivelyResolver::instance().addresses(sHost);
+	if (pAddresses.empty())
+		pAddresses.push_back(sHost);
+
+	Timestamp start;
+	Timespan connectBudget(5, 0);
+	bool bOpen = false;
+	for (unsigned int i = 0; i < pAddresses.size() && !bOpen; ++i)
+	{
+		Timespan remaining = connectBudget - Timespan(start.elapsed());
+		if (remaining.totalMicroseconds() <= 0)
+			break;
+
+		try
+		{
+			SocketAddress address(pAddresses[i], iPort);
+			if (bSecure)
+			{
+				/// the certificate is checked against the name, not the address
+				SecureStreamSocket secureSocket;
+				secureSocket.setPeerHostName(sHost);
+				secureSocket.connect(address, remaining);
+				_socket = secureSocket;
+			}
+			else
+			{
+				_socket.connect(address, remaining);
+			}
+			bOpen = true;
+		}
+		catch (Exception& exc)
+		{
+			ofLogWarning("ofxXively") << "couldn't connect subscription to " << pAddresses[i] << ": " << exc.displayText();
+			ofxXivelyResolver::instance().demote(sHost, pAddresses[i]);
+		}
+	}
+
+	if (!bOpen)
+	{
+		ofLogError("ofxXively") << "couldn't connect subscription to " << sHost;
+		return false;
+	}
+
+	try
+	{
+		_socket.setReceiveTimeout(Timespan(1, 0));
+
+		/// subscribe first, then fetch the current state to catch up
+		/// on anything we missed while disconnected
+		send(_socket, "subscribe", "sub");
+		send(_socket, "get", "get");
+	}
+	catch (Exception& exc)
+	{
+		ofLogError("ofxXively") << "couldn't connect subscription: " << exc.displayText();
+		return false;
+	}
+
+	ofLogVerbose("Xively") << "Subscribed to " << sResource;
+	bConnected = true;
+	return true;
+}
+
+void ofxXivelySubscription::send(StreamSocket& _socket, const string& _sMethod, const string& _sToken) {
+	string sMessage = "{\"method\":\"" + _sMethod + "\",\"resource\":\"" + sResource
+		+ "\",\"headers\":{\"X-ApiKey\":\"" + sApiKey + "\"},\"token\":\"" + _sToken + "\"}\n";
+
+	const char* pcData = sMessage.c_str();
+	int iLeft = sMessage.length();
+	while (iLeft > 0)
+	{
+		int iSent = _socket.sendBytes(pcData, iLeft);
+		pcData += iSent;
+		iLeft -= iSent;
+	}
+}
+
+void ofxXivelySubscription::handleMessage(const string& _sMessage) {
+	/// split the envelope from the feed body, the body has a status of its own
+	string sEnvelope = _sMessage;
+	string sBody;
+	size_t iBody = _sMessage.find("\"body\"");
+	if (iBody != string::npos)
+	{
+		size_t iStart = _sMessage.find('{', iBody);
+		size_t iEnd = iStart == string::npos ? string::npos : jsonObjectEnd(_sMessage, iStart);
+		if (iEnd == string::npos)
+			return;
+
+		sBody = _sMessage.substr(iStart, iEnd - iStart + 1);
+		sEnvelope.erase(iBody, iEnd - iBody + 1);
+	}
+
+	string sStatus = jsonValue(sEnvelope, "status");
+	if (sStatus != "" && sStatus != "200")
+	{
+		/// rejected subscribe or get, usually a bad api key
+		ofxXivelyResponse response(atoi(sStatus.c_str()), _sMessage, sResource, OFX_XIVELY_JSON);
+		ofNotifyEvent(responseEvent, response, this);
+		return;
+	}
+
+	if (sBody == "")
+		return;
+
+	string sUpdated = jsonValue(sBody, "updated");
+
+	lock();
+	bool bNewer = sUpdated == "" || sLastUpdated == "" || sUpdated > sLastUpdated;
+	if (bNewer)
+		sLastUpdated = sUpdated;
+	unlock();
+
+	if (!bNewer)
+	{
+		ofLogVerbose("Xively") << "dropping update from " << sUpdated << ", already seen newer";
+		return;
+	}
+
+	ofxXivelyResponse response(200, sBody, sResource, OFX_XIVELY_JSON);
+	ofNotifyEvent(responseEvent, response, this);
+}
+
+string ofxXivelySubscription::jsonValue(const string& _json, const string& _key, size_t _from) {
+	size_t iPos = _json.find("\"" + _key + "\"", _from);
+	if (iPos == string::npos)
+		return "";
+
+	iPos = _json.find_first_not_of(" \t\r\n:", iPos + _key.length() + 2);
+	if (iPos == string::npos)
+		return "";
+
+	if (_json.at(iPos) == '"')
+	{
+		string sValue;
+		for (++iPos; iPos < _json.length() && _json.at(iPos) != '"'; ++iPos)
+		{
+			if (_json.at(iPos) == '\\' && iPos + 1 < _json.length())
+				++iPos;
+			sValue += _json.at(iPos);
+		}
+		return sValue;
+	}
+
+	size_t iEnd = _json.find_first_of(",}] \t\r\n", iPos);
+	return _json.substr(iPos, iEnd == string::npos ? string::npos : iEnd - iPos);
+}
+
+size_t ofxXivelySubscription::jsonObjectEnd(const string& _json, size_t _start) {
+	int iDepth = 0;
+	bool bInString = false;
+
+	for (size_t i = _start; i < _json.length(); ++i)
+	{
+		char c = _json.at(i);
+		if (bInString)
+		{
+			if (c == '\\')
+				++i;
+			else if (c == '"')
+				bInString = false;
+		}
+		else if (c == '"')
+			bInString = true;
+		else if (c == '{')
+			++iDepth;
+		else if (c == '}' && --iDepth == 0)
+			return i;
+	}
+
+	return string::npos;
+}
@@ -0,0 +1,58 @@
+﻿#ifndef OFX_XIVELY_SUBSCRIPTION_H
+#define OFX_XIVELY_SUBSCRIPTION_H
+
+#include "ofMain.h"
+
+#include "ofxXivelyFeed.h"
+
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/Net/SecureStreamSocket.h"
+#include "Poco/Net/SocketAddress.h"
+
+#define OFX_XIVELY_SOCKET_HOST     "api.xively.com"
+#define OFX_XIVELY_SOCKET_PORT     8091
+#define OFX_XIVELY_MAX_BACKOFF     30
+
+/// Keeps a long-lived connection to the Xively socket server and
+/// broadcasts every feed update it receives as an OFX_XIVELY_JSON response.
+/// After a reconnect the feed is fetched once more and only passed on
+/// if it is newer than the last update seen.
+class ofxXivelySubscription : public ofThread {
+public:
+	ofxXivelySubscription(ofEvent<ofxXivelyResponse>& _responseEvent);
+	~ofxXivelySubscription();
+
+	void					start(int _iFeedId, string _sApiKey, string _sHost = OFX_XIVELY_SOCKET_HOST, int _iPort = OFX_XIVELY_SOCKET_PORT, bool _bSecure = true);
+	/// (re)starts the connection thread, point it at another endpoint for local testing
+	void					stop();
+
+	bool					isConnected() { return bConnected; }
+	string					getLastUpdated();
+
+	static string			jsonValue(const string& _json, const string& _key, size_t _from = 0);
+	static size_t			jsonObjectEnd(const string& _json, size_t _start);
+	/// minimal helpers, just enough to pick values out of Xively messages
+
+protected:
+	void					threadedFunction();
+
+private:
+	bool					connect(StreamSocket& _socket);
+	void					send(StreamSocket& _socket, const string& _sMethod, const string& _sToken);
+	void					handleMessage(const string& _sMessage);
+
+	ofEvent<ofxXivelyResponse>& responseEvent;
+
+	string					sHost;
+	int						iPort;
+	bool					bSecure;
+
+	int						iFeedId;
+	string					sApiKey;
+	string					sResource;
+
+	bool					bConnected;
+	string					sLastUpdated;
+};
+
+#endif